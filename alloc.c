@@ -0,0 +1,228 @@
+/*
+ *	Copyright (C) 2013-2017 Jan Bobrowski <jb@wizard.ae.krakow.pl>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "ttf2woff.h"
+
+/*
+ * While an arena is current, my_alloc() takes memory from it and
+ * arena_free() releases all of it at once, so a conversion doesn't
+ * leak even when it fails half way. Small blocks are carved from
+ * chunks, each thread filling a chunk of its own; my_free() leaves
+ * them be. Big blocks are malloc'd, linked to the arena, and really
+ * freed by my_free(). Without an arena, my_alloc() is plain malloc.
+ * Every block starts with a header telling which kind it is.
+ */
+
+#define CHUNK (64<<10)
+#define BIG (CHUNK/4)
+#define ROUND(N) ((N)+15 & ~(size_t)15)
+
+enum {PLAIN, SMALL, BIG_BLOCK};
+
+struct hdr {
+	size_t size; // capacity, for SMALL
+	size_t kind;
+};
+
+struct big {
+	struct big *prev, *next;
+	struct arena *a;
+	size_t pad;
+	struct hdr h;
+};
+
+struct chunk {
+	struct chunk *next;
+	size_t pad;
+};
+
+struct arena {
+	pthread_mutex_t lock;
+	struct chunk *chunks;
+	struct big big; // list head
+	unsigned long id;
+};
+
+__thread struct arena *arena;
+
+/* this thread's chunk; id tells a stale one from a new arena at the same address */
+static __thread struct {
+	struct arena *a;
+	unsigned long id;
+	u8 *p, *end, *last;
+} cur;
+
+struct arena *arena_new(void)
+{
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	static unsigned long next_id;
+	struct arena *a = malloc(sizeof *a);
+
+	if(!a) errx(1,"Out of memory");
+	pthread_mutex_init(&a->lock, 0);
+	a->chunks = 0;
+	a->big.prev = a->big.next = &a->big;
+	pthread_mutex_lock(&lock);
+	a->id = ++next_id;
+	pthread_mutex_unlock(&lock);
+	return a;
+}
+
+void arena_free(struct arena *a)
+{
+	struct big *b, *nb;
+	struct chunk *c, *nc;
+
+	if(!a)
+		return;
+	for(b=a->big.next; b!=&a->big; b=nb) {
+		nb = b->next;
+		free(b);
+	}
+	for(c=a->chunks; c; c=nc) {
+		nc = c->next;
+		free(c);
+	}
+	pthread_mutex_destroy(&a->lock);
+	if(cur.a == a)
+		cur.a = 0;
+	free(a);
+}
+
+static int in_chunk(struct arena *a)
+{
+	return cur.a == a && cur.id == a->id;
+}
+
+static void new_chunk(struct arena *a)
+{
+	struct chunk *c = malloc(CHUNK);
+	if(!c) errx(1,"Out of memory");
+	pthread_mutex_lock(&a->lock);
+	c->next = a->chunks;
+	a->chunks = c;
+	pthread_mutex_unlock(&a->lock);
+	cur.a = a;
+	cur.id = a->id;
+	cur.p = (u8*)(c+1);
+	cur.end = (u8*)c + CHUNK;
+	cur.last = 0;
+}
+
+static void link_big(struct big *b)
+{
+	struct arena *a = b->a;
+	pthread_mutex_lock(&a->lock);
+	b->prev = &a->big;
+	b->next = a->big.next;
+	b->next->prev = b;
+	a->big.next = b;
+	pthread_mutex_unlock(&a->lock);
+}
+
+static void unlink_big(struct big *b)
+{
+	struct arena *a = b->a;
+	pthread_mutex_lock(&a->lock);
+	b->prev->next = b->next;
+	b->next->prev = b->prev;
+	pthread_mutex_unlock(&a->lock);
+}
+
+void *my_alloc(size_t sz)
+{
+	struct arena *a = arena;
+	struct hdr *h;
+
+	if(stats)
+		stat_alloc(sz);
+	if(!a) {
+		h = malloc(sizeof *h + sz);
+		if(!h) errx(1,"Out of memory");
+		h->kind = PLAIN;
+	} else if(sz > BIG) {
+		struct big *b = malloc(sizeof *b + sz);
+		if(!b) errx(1,"Out of memory");
+		b->a = a;
+		link_big(b);
+		h = &b->h;
+		h->kind = BIG_BLOCK;
+	} else {
+		size_t n = sizeof *h + ROUND(sz);
+		if(!in_chunk(a) || cur.end - cur.p < n)
+			new_chunk(a);
+		h = (struct hdr*)cur.p;
+		cur.last = cur.p;
+		cur.p += n;
+		h->kind = SMALL;
+		sz = ROUND(sz);
+	}
+	h->size = sz;
+	return h+1;
+}
+
+void *my_free(void *p)
+{
+	struct hdr *h = (struct hdr*)p - 1;
+
+	if(!p)
+		return 0;
+	switch(h->kind) {
+	case PLAIN:
+		free(h);
+		break;
+	case BIG_BLOCK: {
+		struct big *b = (struct big*)((char*)h - offsetof(struct big, h));
+		unlink_big(b);
+		free(b);
+	}
+	}
+	return 0;
+}
+
+void *my_realloc(void *p, size_t sz)
+{
+	struct hdr *h = (struct hdr*)p - 1;
+	void *n;
+
+	if(!p)
+		return my_alloc(sz);
+	if(stats)
+		stat_alloc(sz);
+
+	switch(h->kind) {
+	case PLAIN:
+		h = realloc(h, sizeof *h + sz);
+		if(!h) errx(1,"Out of memory");
+		return h+1;
+	case BIG_BLOCK: {
+		struct big *b = (struct big*)((char*)h - offsetof(struct big, h));
+		unlink_big(b);
+		b = realloc(b, sizeof *b + sz);
+		if(!b) errx(1,"Out of memory");
+		link_big(b);
+		return &b->h + 1;
+	}
+	}
+
+	if(sz <= h->size)
+		return p;
+	// the last block of this thread's chunk may grow in place
+	if(sz <= BIG && (u8*)h == cur.last && arena && in_chunk(arena)
+	 && ROUND(sz) <= cur.end - (u8*)p) {
+		h->size = ROUND(sz);
+		cur.p = (u8*)p + h->size;
+		return p;
+	}
+	n = my_alloc(sz);
+	memcpy(n, p, h->size);
+	return n;
+}
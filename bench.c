@@ -0,0 +1,271 @@
+/*
+ *	Copyright (C) 2013-2017 Jan Bobrowski <jb@wizard.ae.krakow.pl>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
+#include "ttf2woff.h"
+
+/*
+ * Benchmark: every font in a directory goes through the steps of a
+ * conversion to WOFF, and then to TTF, reps times over. Fonts are taken
+ * one at a time, so that step times are not mixed up; the pool works
+ * on the tables. Results are printed as JSON: wall time of each step
+ * (in total and for the quickest repetition), bytes in and out, how
+ * each kind of table compressed, and peak RSS. A collection is
+ * represented by its first font.
+ */
+
+enum {READ, OPTIMIZE, CHECKSUMS, GEN_WOFF, GEN_TTF, NSTAGES};
+static char *stage_name[NSTAGES] = {"read", "optimize", "checksums", "gen_woff", "gen_ttf"};
+
+struct font {
+	char *path, *name;
+	unsigned in, woff, ttf; // sizes, from the first repetition
+	int failed;
+};
+
+struct tag_stat {
+	char name[8];
+	unsigned long long in, out;
+	int count;
+};
+
+struct bench {
+	struct options *opt;
+	double stage[NSTAGES]; // this repetition
+	struct tag_stat *tags;
+	int ntags, first;
+};
+
+static void lap(struct bench *b, int stage, double *t)
+{
+	double now = clock_now();
+	b->stage[stage] += now - *t;
+	*t = now;
+}
+
+static void tally(struct bench *b, struct ttf *ttf)
+{
+	int i, j;
+	for(i=0; i<ttf->ntables; i++) {
+		struct table *t = &ttf->tables[i];
+		struct tag_stat *s;
+		for(j=0; j<b->ntags; j++)
+			if(strcmp(b->tags[j].name, t->name)==0)
+				break;
+		if(j == b->ntags) {
+			// not my_alloc(): the font's arena goes away
+			s = realloc(b->tags, (b->ntags+1) * sizeof *s);
+			if(!s) errx(1,"Out of memory");
+			b->tags = s;
+			s += b->ntags++;
+			memset(s, 0, sizeof *s);
+			strcpy(s->name, t->name);
+		}
+		s = &b->tags[j];
+		s->in += t->buf.len;
+		s->out += t->zbuf.len;
+		s->count++;
+	}
+}
+
+static void run_font(struct bench *b, struct font *f)
+{
+	struct options o = *b->opt;
+	struct output out;
+	struct ttf *ttf;
+	struct buf file;
+	double t;
+
+	file = read_file(f->path, 0);
+	f->in = file.len;
+
+	t = clock_now();
+	read_font(&ttf, file.ptr, file.len, 0);
+	lap(b, READ, &t);
+
+	o.otype = fmt_WOFF;
+	if(setup_font(ttf, &o))
+		optimize(ttf);
+	lap(b, OPTIMIZE, &t);
+
+	recalc_checksums(ttf);
+	lap(b, CHECKSUMS, &t);
+
+	if(o.budget)
+		o.deadline = t + o.budget;
+	gen_woff(&out, ttf, &o);
+	lap(b, GEN_WOFF, &t);
+	if(b->first) {
+		f->woff = out.len;
+		tally(b, ttf);
+	}
+	out_free(&out);
+
+	t = clock_now();
+	gen_ttf(&out, ttf);
+	lap(b, GEN_TTF, &t);
+	if(b->first)
+		f->ttf = out.len;
+	out_free(&out);
+}
+
+static void bench_font(struct bench *b, struct font *f)
+{
+	struct trap tr, *prev = trap;
+	struct arena *prev_arena = arena;
+
+	tr.name = f->name;
+	tr.msg = 0;
+	trap = &tr;
+	arena = arena_new();
+	if(!setjmp(tr.jb))
+		run_font(b, f);
+	else
+		f->failed = 1;
+	trap = prev;
+	arena_free(arena);
+	arena = prev_arena;
+}
+
+static int cmp_font(const void *a, const void *b) {
+	return strcmp(((struct font*)a)->name, ((struct font*)b)->name);
+}
+
+static int list_fonts(char *dir, struct font **fonts)
+{
+	struct dirent *d;
+	DIR *dp = opendir(dir);
+	int n = 0;
+
+	if(!dp)
+		err(1, "%s", dir);
+	*fonts = 0;
+	while((d = readdir(dp))) {
+		struct stat st;
+		char *path;
+		if(d->d_name[0] == '.')
+			continue;
+		path = my_alloc(strlen(dir) + strlen(d->d_name) + 2);
+		sprintf(path, "%s/%s", dir, d->d_name);
+		if(stat(path, &st) || !S_ISREG(st.st_mode)) {
+			my_free(path);
+			continue;
+		}
+		if(!(n & 15))
+			*fonts = my_realloc(*fonts, (n+16) * sizeof **fonts);
+		memset(&(*fonts)[n], 0, sizeof **fonts);
+		(*fonts)[n].path = path;
+		(*fonts)[n].name = path + strlen(dir) + 1;
+		n++;
+	}
+	closedir(dp);
+	qsort(*fonts, n, sizeof **fonts, cmp_font);
+	return n;
+}
+
+static long peak_rss(void)
+{
+#ifndef WIN32
+	struct rusage ru;
+	if(getrusage(RUSAGE_SELF, &ru) == 0)
+		return ru.ru_maxrss; // KiB on Linux
+#endif
+	return -1;
+}
+
+static void put_str(char *s)
+{
+	putchar('"');
+	for(; *s; s++) {
+		if(*s=='"' || *s=='\\')
+			printf("\\%c", *s);
+		else if((u8)*s < ' ')
+			printf("\\u%04x", (u8)*s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+int bench(char *dir, int reps, struct options *opt)
+{
+	struct bench b = {opt};
+	double total[NSTAGES] = {0}, best[NSTAGES];
+	unsigned long long in = 0, woff = 0, ttf = 0;
+	struct font *fonts;
+	int i, r, n, failed = 0;
+
+	g.stdout_used = 1; // messages to stderr, JSON to stdout
+	n = list_fonts(dir, &fonts);
+
+	for(r=0; r<reps; r++) {
+		memset(b.stage, 0, sizeof b.stage);
+		b.first = r==0;
+		for(i=0; i<n; i++)
+			if(!fonts[i].failed)
+				bench_font(&b, &fonts[i]);
+		for(i=0; i<NSTAGES; i++) {
+			total[i] += b.stage[i];
+			if(!r || b.stage[i] < best[i])
+				best[i] = b.stage[i];
+		}
+	}
+
+	printf("{\n \"dir\": ");
+	put_str(dir);
+	printf(",\n \"reps\": %d,\n \"compressor\": \"%s\",\n \"iterations\": %d,\n",
+	 reps, opt->best ? "best" : opt->comp->name, opt->zopfli_iter);
+
+	printf(" \"stages\": {");
+	for(i=0; i<NSTAGES; i++)
+		printf("%s\n  \"%s\": {\"total\": %.6f, \"best\": %.6f}",
+		 i ? "," : "", stage_name[i], total[i], reps ? best[i] : 0);
+	printf("\n },\n");
+
+	printf(" \"files\": [");
+	for(i=0; i<n; i++) {
+		struct font *f = &fonts[i];
+		printf("%s\n  {\"name\": ", i ? "," : "");
+		put_str(f->name);
+		if(f->failed) {
+			printf(", \"failed\": true}");
+			failed++;
+			continue;
+		}
+		printf(", \"in\": %u, \"woff\": %u, \"ttf\": %u}", f->in, f->woff, f->ttf);
+		in += f->in;
+		woff += f->woff;
+		ttf += f->ttf;
+	}
+	printf("\n ],\n");
+	printf(" \"fonts\": %d,\n \"failed\": %d,\n", n, failed);
+	printf(" \"bytes\": {\"in\": %llu, \"woff\": %llu, \"ttf\": %llu},\n", in, woff, ttf);
+
+	printf(" \"tables\": {");
+	for(i=0; i<b.ntags; i++) {
+		struct tag_stat *s = &b.tags[i];
+		printf("%s\n  ", i ? "," : "");
+		put_str(s->name);
+		printf(": {\"count\": %d, \"in\": %llu, \"out\": %llu, \"ratio\": %.4f}",
+		 s->count, s->in, s->out, s->in ? (double)s->out/s->in : 1.);
+	}
+	printf("\n },\n");
+	printf(" \"peak_rss_kb\": %ld\n}\n", peak_rss());
+
+	free(b.tags);
+	for(i=0; i<n; i++)
+		my_free(fonts[i].path);
+	my_free(fonts);
+	return failed ? 1 : 0;
+}
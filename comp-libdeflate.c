@@ -0,0 +1,93 @@
+/*
+ *	Copyright (C) 2013-2017 Jan Bobrowski <jb@wizard.ae.krakow.pl>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <libdeflate.h>
+#include "ttf2woff.h"
+
+static int level(struct effort *e)
+{
+	return e->level ? e->level : LIBDEFLATE_LEVEL;
+}
+
+static char *libdeflate_tag(char buf[16], struct effort *e)
+{
+	sprintf(buf, "libdeflate/%d", level(e));
+	return buf;
+}
+
+/*
+ * Each thread keeps its compressor, set up for the level last used,
+ * and frees it when it exits.
+ */
+struct state {
+	struct libdeflate_compressor *c;
+	int level;
+};
+
+static pthread_key_t state_key;
+static pthread_once_t state_once = PTHREAD_ONCE_INIT;
+
+static void free_state(void *p)
+{
+	struct state *s = p;
+	libdeflate_free_compressor(s->c);
+	free(s);
+}
+
+static void state_init(void)
+{
+	pthread_key_create(&state_key, free_state);
+}
+
+static struct libdeflate_compressor *thread_compressor(int l)
+{
+	struct state *s;
+	pthread_once(&state_once, state_init);
+	s = pthread_getspecific(state_key);
+	if(!s) {
+		s = calloc(1, sizeof *s);
+		if(!s || pthread_setspecific(state_key, s)) {
+			free(s);
+			return 0;
+		}
+	}
+	if(s->c && s->level != l) {
+		libdeflate_free_compressor(s->c);
+		s->c = 0;
+	}
+	if(!s->c) {
+		s->c = libdeflate_alloc_compressor(l);
+		s->level = l;
+	}
+	return s->c;
+}
+
+static int libdeflate_deflate(struct buf *out, struct buf *inp, struct effort *e)
+{
+	struct libdeflate_compressor *c = thread_compressor(level(e));
+	u8 *b;
+	size_t len;
+
+	if(!c)
+		errx(1,"Out of memory");
+	b = my_alloc(inp->len);
+	len = libdeflate_zlib_compress(c, inp->ptr, inp->len, b, inp->len);
+
+	if(len && REALLY_SMALLER(len, inp->len)) {
+		out->ptr = b;
+		out->len = len;
+		return 1;
+	}
+	my_free(b);
+	return 0;
+}
+
+struct compressor comp_libdeflate = {"libdeflate", libdeflate_deflate, libdeflate_tag};
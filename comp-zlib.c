@@ -10,9 +10,12 @@
 #include <zlib.h>
 #include "ttf2woff.h"
 
-char *copression_by = "zlib";
+static char *zlib_tag(char buf[16], struct effort *e)
+{
+	return "zlib/9";
+}
 
-int zlib_compress(struct buf *out, struct buf *inp)
+static int zlib_deflate(struct buf *out, struct buf *inp, struct effort *e)
 {
 	u8 *b;
 	int v;
@@ -32,3 +35,5 @@ int zlib_compress(struct buf *out, struct buf *inp)
 		return 0;
 	}
 }
+
+struct compressor comp_zlib = {"zlib", zlib_deflate, zlib_tag};
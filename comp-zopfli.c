@@ -7,6 +7,8 @@
  */
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
 #include "ttf2woff.h"
 
 #include "zopfli/zlib_container.c"
@@ -20,37 +22,101 @@
 #include "zopfli/util.c"
 #include "zopfli/katajainen.c"
 
-#define adler32 zlib_adler32
-#include <zlib.h>
+static char *zopfli_tag(char buf[16], struct effort *e)
+{
+	if(!e->iterations)
+		return comp_zlib.tag(buf, e);
+	sprintf(buf, "zopfli/%d", e->iterations);
+	return buf;
+}
+
+/*
+ * Each thread keeps its Zopfli buffers (hash, match cache, LZ77 store)
+ * from one table to the next, grown to the largest block seen, and
+ * frees them when it exits.
+ */
+static pthread_key_t state_key;
+static pthread_once_t state_once = PTHREAD_ONCE_INIT;
+
+static void free_state(void *p)
+{
+	ZopfliCleanState(p);
+	free(p);
+}
+
+static void state_init(void)
+{
+	pthread_key_create(&state_key, free_state);
+}
+
+static ZopfliState *thread_state(void)
+{
+	ZopfliState *s;
+	pthread_once(&state_once, state_init);
+	s = pthread_getspecific(state_key);
+	if(!s) {
+		s = malloc(sizeof *s);
+		if(!s)
+			return 0; // Zopfli allocates its own
+		ZopfliInitState(s);
+		if(pthread_setspecific(state_key, s)) {
+			free(s);
+			return 0;
+		}
+	}
+	return s;
+}
 
-char *copression_by = "zopfli";
+static int stop_iterating(void *arg)
+{
+	struct effort *e = arg;
+	if(clock_now() < e->until)
+		return 0;
+	__atomic_store_n(&e->stopped, 1, __ATOMIC_RELAXED); // may be several threads
+	return 1;
+}
 
-int zlib_compress(struct buf *out, struct buf *inp)
+static int zopfli_deflate(struct buf *out, struct buf *inp, struct effort *e)
 {
 	ZopfliOptions opt = {0};
 	u8 *b = 0;
 	size_t sz = 0;
 
-	opt.numiterations = 15;
+	if(!e->iterations)
+		return comp_zlib.compress(out, inp, e);
+
+	opt.numiterations = e->iterations;
+	opt.state = thread_state();
+	if(pool_size() > 1) {
+		opt.parallel = pool_run;
+		opt.parallel_blocks = pool_size();
+		opt.thread_state = thread_state;
+	}
+	opt.cache_limit = (size_t)e->cache_mb << 20;
+	if(e->until) {
+		opt.stop = stop_iterating;
+		opt.stop_arg = e;
+	}
 	ZopfliZlibCompress(&opt, inp->ptr, inp->len, &b, &sz);
 
 	if(REALLY_SMALLER(sz, inp->len)) {
 
-#if 1
-		/* Trust, but verify */
-		uLong tmpl = inp->len;
-		Bytef *tmpb = my_alloc(inp->len);
-		int v = uncompress(tmpb, &tmpl, b, sz);
-		if(v!=Z_OK || tmpl!=inp->len)
-			errx(3,"Zopfli error");
-		my_free(tmpb);
-#endif
-
-		out->ptr = b;
+		out->ptr = my_alloc(sz); // callers free it with my_free()
 		out->len = sz;
+		memcpy(out->ptr, b, sz);
+		free(b);
+
+		/* Trust, but verify */
+		if(e->verify == VERIFY_INLINE) {
+			if(!zlib_verify(out, inp))
+				errx(3,"Zopfli error");
+		} else if(e->verify == VERIFY_BACKGROUND)
+			e->unverified = 1;
 		return 1;
 	} else {
 		free(b);
 		return 0;
 	}
 }
+
+struct compressor comp_zopfli = {"zopfli", zopfli_deflate, zopfli_tag};
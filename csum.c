@@ -0,0 +1,99 @@
+/*
+ *	Copyright (C) 2013-2017 Jan Bobrowski <jb@wizard.ae.krakow.pl>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include "ttf2woff.h"
+
+/*
+ * Table checksum: sum of big-endian 32-bit words, the last one padded
+ * with zeros. On x86 the words are byte-swapped and added a vector at
+ * a time, with SSE2 or AVX2 as the CPU allows.
+ */
+
+static u32 csum_scalar(u8 *p, size_t n)
+{
+	u32 s = 0;
+	for(; n >= 4; p += 4, n -= 4)
+		s += g32(p);
+	if(n) {
+		u8 w[4] = {0};
+		memcpy(w, p, n);
+		s += g32(w);
+	}
+	return s;
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static u32 csum_sse2(u8 *p, size_t n)
+{
+	__m128i s = _mm_setzero_si128();
+	u32 v[4];
+
+	for(; n >= 16; p += 16, n -= 16) {
+		__m128i x = _mm_loadu_si128((__m128i*)p);
+		x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+		x = _mm_shufflelo_epi16(x, 0xB1);
+		x = _mm_shufflehi_epi16(x, 0xB1);
+		s = _mm_add_epi32(s, x);
+	}
+	_mm_storeu_si128((__m128i*)v, s);
+	return v[0] + v[1] + v[2] + v[3] + csum_scalar(p, n);
+}
+
+__attribute__((target("avx2")))
+static u32 csum_avx2(u8 *p, size_t n)
+{
+	const __m256i bswap = _mm256_setr_epi8(
+		3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12,
+		3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12);
+	__m256i s0 = _mm256_setzero_si256(), s1 = s0;
+	u32 v[8];
+
+	for(; n >= 64; p += 64, n -= 64) {
+		__m256i x = _mm256_loadu_si256((__m256i*)p);
+		__m256i y = _mm256_loadu_si256((__m256i*)(p+32));
+		s0 = _mm256_add_epi32(s0, _mm256_shuffle_epi8(x, bswap));
+		s1 = _mm256_add_epi32(s1, _mm256_shuffle_epi8(y, bswap));
+	}
+	_mm256_storeu_si256((__m256i*)v, _mm256_add_epi32(s0, s1));
+	return v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7] + csum_sse2(p, n);
+}
+
+static u32 (*csum_fn)(u8 *p, size_t n);
+
+static void csum_init(void)
+{
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		csum_fn = csum_avx2;
+	else if(__builtin_cpu_supports("sse2"))
+		csum_fn = csum_sse2;
+	else
+		csum_fn = csum_scalar;
+}
+
+u32 calc_csum(u8 *p, size_t n)
+{
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, csum_init);
+	return csum_fn(p, n);
+}
+
+#else
+
+u32 calc_csum(u8 *p, size_t n)
+{
+	return csum_scalar(p, n);
+}
+
+#endif
@@ -0,0 +1,361 @@
+/*
+ *	Copyright (C) 2013-2017 Jan Bobrowski <jb@wizard.ae.krakow.pl>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include "ttf2woff.h"
+
+struct flags g;
+__thread struct trap *trap;
+
+void echo(char *f, ...)
+{
+	FILE *o = g.stdout_used ? stderr : stdout;
+	char msg[256];
+	va_list va;
+	if(trap && trap->msg)
+		return;
+	va_start(va, f);
+	vsnprintf(msg, sizeof msg, f, va);
+	va_end(va);
+	// one call, so that lines from concurrent jobs don't mix
+	if(trap && trap->name)
+		fprintf(o, "%s: %s\n", trap->name, msg);
+	else
+		fprintf(o, "%s\n", msg);
+}
+
+void unwind(int status)
+{
+	if(!trap)
+		exit(status);
+	trap->status = status;
+	longjmp(trap->jb, 1);
+}
+
+void fail(int status, int e, char *f, ...)
+{
+	char msg[512];
+	unsigned l = 0;
+	va_list va;
+
+	if(trap && trap->msg) {
+		va_start(va, f);
+		l = vsnprintf(trap->msg, TRAP_MSG, f, va);
+		va_end(va);
+		if(e >= 0 && l < TRAP_MSG)
+			snprintf(trap->msg+l, TRAP_MSG-l, ": %s", strerror(e));
+		unwind(status);
+	}
+
+	if(trap && trap->name) {
+		l = snprintf(msg, sizeof msg, "%s: ", trap->name);
+		if(l >= sizeof msg) l = sizeof msg - 1;
+	}
+	va_start(va, f);
+	vsnprintf(msg+l, sizeof msg - l, f, va);
+	va_end(va);
+
+	if(e >= 0) {
+		errno = e;
+		warn("%s", msg);
+	} else
+		warnx("%s", msg);
+	unwind(status);
+}
+
+double clock_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void alloc_tables(struct ttf *ttf)
+{
+	int sz = ttf->ntables*sizeof *ttf->tables;
+	ttf->tables = my_alloc(sz);
+	memset(ttf->tables, 0, sz);
+}
+
+void name_table(struct table *t) {
+	char *d = t->name;
+	int i;
+	for(i=24; i>=0; i-=8) {
+		char c = t->tag>>i;
+		if(c>' ' && c<127)
+			*d++ = c;
+	}
+	*d = 0;
+}
+
+void recalc_checksums(struct ttf *ttf)
+{
+	u8 h[12];
+	u32 font_csum, off;
+	int i, modified;
+	struct table *head = 0;
+	struct table *DSIG = 0;
+
+	modified = ttf->modified;
+	for(i=0; i<ttf->ntables; i++) {
+		struct table *t = ttf->tab_pos[i];
+		u8 *p = t->buf.ptr;
+		u32 csum;
+
+		if(t->tag == g32("DSIG") && t->buf.len>8)
+			DSIG = t;
+
+		if(t->tag != g32("head"))
+			csum = calc_csum(p, t->buf.len);
+		else {
+			head = t;
+			csum = calc_csum(p, 8);
+			csum += calc_csum(p+12, t->buf.len-12);
+		}
+		modified |= t->modified;
+		if(csum != t->csum) {
+			modified = 1;
+			t->csum = csum;
+			if(!t->modified && !g.silent)
+				echo("Corrected checksum of table %s", t->name);
+		}
+	}
+
+	if(modified && DSIG) {
+remove_signature:
+		if(DSIG->free_buf)
+			my_free(DSIG->buf.ptr);
+		DSIG->buf.len = 8;
+		DSIG->buf.ptr = (u8*)"\0\0\0\1\0\0\0"; // empty DSIG
+		DSIG->free_buf = 0;
+		DSIG->csum = calc_csum(DSIG->buf.ptr, DSIG->buf.len);
+		DSIG = 0;
+		if(g.verbose)
+			echo("Digital signature removed");
+	}
+
+	put_ttf_header(h, ttf);
+	font_csum = calc_csum(h, 12);
+
+	off = 12 + 16*ttf->ntables;
+	for(i=0; i<ttf->ntables; i++) {
+		struct table *t = ttf->tab_pos[i];
+		font_csum += t->tag + t->csum + off + t->buf.len;
+		font_csum += t->csum;
+		off += t->buf.len+3 & ~3;
+	}
+
+	if(!head || head->buf.len<16)
+		errx(1, "No head table");
+
+	{
+		u8 *p = head->buf.ptr + 8;
+		font_csum = 0xB1B0AFBA - font_csum;
+		if(font_csum != g32(p)) {
+			if(DSIG)
+				goto remove_signature;
+			p32(p, font_csum);
+			if(!modified)
+				echo("Corrected checkSumAdjustment");
+		}
+	}
+}
+
+static int cmp_tab_pos(const void *a, const void *b) {
+	return (*(struct table**)a)->pos - (*(struct table**)b)->pos;
+}
+
+void free_ttf(struct ttf *ttf)
+{
+	int i;
+	for(i=0; i<ttf->ntables; i++) {
+		struct table *t = &ttf->tables[i];
+		if(t->zbuf.ptr && t->zbuf.ptr != t->buf.ptr && !t->zshared)
+			my_free(t->zbuf.ptr);
+		if(t->free_buf)
+			my_free(t->buf.ptr);
+	}
+	my_free(ttf->tables);
+	my_free(ttf->tab_pos);
+	my_free(ttf->aux_buf.ptr);
+	forget(ttf);
+}
+
+
+char *fmt_name[] = {"?", "TTF", "WOFF", "WOFF2", "TTC"};
+
+int font_type(u8 *data, size_t len)
+{
+	if(len < 28)
+		errx(2,"File too short");
+	if(g32(data) == g32("wOFF"))
+		return fmt_WOFF;
+	if(g32(data) == g32("ttcf"))
+		return fmt_TTC;
+	if(g32(data) == g32("wOF2"))
+		return fmt_WOFF2;
+	return fmt_TTF;
+}
+
+static int read_faces(struct ttf **faces, u8 *data, size_t len, int fontn, int type)
+{
+	struct ttf *f;
+
+	if(type == fmt_TTC && fontn < 0)
+		return read_ttc_all(faces, data, len);
+
+	f = my_alloc(sizeof *f);
+	memset(f, 0, sizeof *f);
+	*faces = f;
+
+	switch(type) {
+	case fmt_WOFF:
+		read_woff(f, data, len);
+		break;
+	case fmt_TTC:
+		read_ttc(f, data, len, fontn);
+		break;
+	case fmt_WOFF2:
+#ifndef READ_WOFF2
+		errx(1, "WOFF2 is not supported");
+#else
+		read_woff2(f, data, len);
+		break;
+#endif
+	default:
+		read_ttf(f, data, len, 0);
+	}
+	return 1;
+}
+
+/* fontn < 0 reads all faces of a collection; returns the number of faces */
+int read_font(struct ttf **faces, u8 *data, size_t len, int fontn)
+{
+	int n, type = font_type(data, len);
+	struct timing t;
+
+	stat_start(&t);
+	n = read_faces(faces, data, len, fontn, type);
+	stat_stop(&t, "read", 0, 0);
+	return n;
+}
+
+/* names are NUL terminated, one after another */
+void remove_tables(struct ttf *ttf, struct buf *xtab)
+{
+	char *p=(char*)xtab->ptr, *e=p+xtab->len;
+	int i;
+
+	for(; p<e; p=strchr(p,0)+1) {
+		struct table *t;
+		struct buf *b;
+		if(strcmp(p,"metadata")==0) {
+			b = &ttf->woff_meta;
+rm_meta:
+			if(b->len) {
+				b->len = 0;
+				ttf->modified_meta = 1;
+			}
+			continue;
+		}
+		if(strcmp(p,"private")==0) {
+			b = &ttf->woff_priv;
+			goto rm_meta;
+		}
+		for(i=0; i<ttf->ntables; i++) {
+			t = &ttf->tables[i];
+			if(strcmp(t->name, p)==0)
+				goto rm_tab;
+		}
+		echo("Table %s not found", p);
+		if(0) {
+rm_tab:
+			memmove(t, t+1, (char*)(ttf->tables+ttf->ntables) - (char*)(t+1));
+			ttf->ntables--;
+			ttf->modified = 1;
+			if(g.verbose)
+				echo("Table %s removed", p);
+		}
+	}
+}
+
+/* 1 if the font is to be optimized */
+int setup_font(struct ttf *ttf, struct options *opt)
+{
+	int i, mayoptim;
+
+	if(opt->otype==fmt_WOFF) {
+		if(opt->meta.ptr)
+			ttf->woff_meta = opt->meta;
+		if(opt->priv.ptr)
+			ttf->woff_priv = opt->priv;
+	}
+
+	remove_tables(ttf, &opt->xtab);
+
+	ttf->tab_pos = my_alloc(ttf->ntables * sizeof *ttf->tab_pos);
+	for(i=0; i<ttf->ntables; i++)
+		ttf->tab_pos[i] = &ttf->tables[i];
+	qsort(ttf->tab_pos, ttf->ntables, sizeof *ttf->tab_pos, cmp_tab_pos);
+
+	mayoptim = opt->mayoptim;
+	if(!ttf->modified) {
+		struct table *t = find_table(ttf, "DSIG");
+		if(t && t->buf.len>8)
+			mayoptim = opt->optimize;
+	}
+	return mayoptim;
+}
+
+void gen_font(struct output *out, struct ttf *ttf, struct options *opt)
+{
+	switch(opt->otype) {
+	case fmt_TTF:
+		gen_ttf(out, ttf);
+		break;
+	case fmt_WOFF:
+		gen_woff(out, ttf, opt);
+		break;
+#ifdef WRITE_WOFF2
+	case fmt_WOFF2:
+		gen_woff2(out, ttf, opt->brotli_q);
+		break;
+#endif
+	default:
+		errx(1, "%s output is not supported", fmt_name[opt->otype]);
+	}
+}
+
+void make_font(struct output *out, struct ttf *ttf, struct options *opt)
+{
+	struct timing t;
+
+	if(setup_font(ttf, opt))
+		optimize(ttf);
+
+#ifdef WRITE_WOFF2
+	if(opt->otype==fmt_WOFF2) {
+		stat_start(&t);
+		prepare_woff2(ttf);
+		stat_stop(&t, "prepare_woff2", 0, 0);
+	}
+#endif
+
+	stat_start(&t);
+	recalc_checksums(ttf);
+	stat_stop(&t, "checksums", 0, 0);
+
+	// includes compression, which is also counted by table
+	stat_start(&t);
+	gen_font(out, ttf, opt);
+	stat_stop(&t, "generate", 0, 0);
+}
@@ -25,20 +25,20 @@ u8 *put_ttf_header(u8 buf[12], struct ttf *ttf)
 	return p;
 }
 
-void gen_ttf(struct buf *out, struct ttf *ttf)
+void gen_ttf(struct output *out, struct ttf *ttf)
 {
-	unsigned sfnt_size;
+	unsigned sfnt_size, hdr_size;
 	u8 *buf, *p;
 	int i;
 
-	sfnt_size = 12 + 16*ttf->ntables;
+	sfnt_size = hdr_size = 12 + 16*ttf->ntables;
 	for(i=0; i<ttf->ntables; i++) {
 		struct table *t = ttf->tab_pos[i];
 		t->pos = sfnt_size; // remember offset in output file
 		sfnt_size += t->buf.len+3 & ~3;
 	}
 
-	buf = my_alloc(sfnt_size);
+	buf = my_alloc(hdr_size);
 	p = put_ttf_header(buf, ttf);
 
 	for(i=0; i<ttf->ntables; i++) {
@@ -49,15 +49,15 @@ void gen_ttf(struct buf *out, struct ttf *ttf)
 		p = p32(p, t->buf.len);
 	}
 
+	assert(p == buf+hdr_size);
+
+	memset(out, 0, sizeof *out);
+	out_add(out, buf, hdr_size, 1);
 	for(i=0; i<ttf->ntables; i++) {
 		struct table *t = ttf->tab_pos[i];
-		unsigned sz = t->buf.len;
-		p = append(p, t->buf.ptr, sz);
-		while(sz&3) *p++=0, sz++;
+		out_add(out, t->buf.ptr, t->buf.len, 0);
+		out_pad(out);
 	}
 
-	assert(p == buf+sfnt_size);
-
-	out->ptr = buf;
-	out->len = sfnt_size;
+	assert(out->len == sfnt_size);
 }
@@ -9,34 +9,241 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <pthread.h>
 #include "ttf2woff.h"
 
 #define MIN_COMPR 16
+#define ZOPFLI_RATE 3e-6 // seconds per byte, first guess
+#define ZOPFLI_GAIN 0.03 // what zopfli typically saves on zlib output
+#define MIN_GAIN 64 // bytes, worth refining for in best mode
 
-void gen_woff(struct buf *out, struct ttf *ttf)
+struct zjob {
+	struct buf *out, *inp;
+	char *name;
+};
+
+struct zjobs {
+	struct zjob *job;
+	struct options *opt;
+	struct checks *checks;
+	pthread_mutex_t lock;
+	double weight; // of the timed jobs not started yet
+	double rate; // seconds per byte, as seen so far
+	int threads;
+};
+
+static int zcompress(struct zjob *j, struct buf *out, struct effort *e)
+{
+	struct timing t;
+	int v;
+	stat_start(&t);
+	v = zcache_compress(out, j->inp, e);
+	stat_stop(&t, "compress", j->name, e->comp->name);
+	return v;
+}
+
+static void compress_job(void *arg, int i)
+{
+	struct zjobs *z = arg;
+	struct zjob *j = z->job + i;
+	struct effort e = {z->opt->comp, z->opt->zopfli_iter};
+	e.verify = z->opt->verify;
+	e.cache_mb = z->opt->zopfli_cache;
+	e.level = z->opt->level;
+	if(zcompress(j, j->out, &e) && e.unverified)
+		verify_later(z->checks, j->out, j->inp);
+}
+
+static void baseline_job(void *arg, int i)
+{
+	struct zjobs *z = arg;
+	struct zjob *j = z->job + i;
+	struct effort e = {&comp_zlib};
+	zcompress(j, j->out, &e);
+}
+
+static int worth_refining(struct zjobs *z, struct zjob *j)
+{
+	if(j->out->ptr == j->inp->ptr)
+		return 0; // zlib didn't help, zopfli won't much
+	return !z->opt->best || j->out->len * ZOPFLI_GAIN >= MIN_GAIN;
+}
+
+/*
+ * The refining pass runs over what zlib made of the tables and keeps
+ * whichever is smaller. In best mode, only tables big enough for the
+ * expected gain to matter get there.
+ *
+ * With a time budget, what is left of it is shared among the tables
+ * in proportion to their zlib compressed size, as that's what zopfli
+ * can save on. A table gets zopfli if its share seems enough for one
+ * iteration, and zopfli stops iterating when the share is used up.
+ */
+static void refine_job(void *arg, int i)
+{
+	struct zjobs *z = arg;
+	struct zjob *j = z->job + i;
+	struct effort e = {z->opt->comp, z->opt->zopfli_iter};
+	double t0 = 0, share, rate;
+	struct buf zb;
+
+	e.verify = z->opt->verify;
+	e.cache_mb = z->opt->zopfli_cache;
+	e.level = z->opt->level;
+	if(!worth_refining(z, j))
+		return;
+
+	if(z->opt->deadline) {
+		double w = j->out->len;
+		pthread_mutex_lock(&z->lock);
+		t0 = clock_now();
+		share = (z->opt->deadline - t0) * z->threads * w / z->weight;
+		z->weight -= w;
+		rate = z->rate;
+		pthread_mutex_unlock(&z->lock);
+
+		if(j->inp->len * rate > share) {
+			if(g.verbose)
+				echo("No time for zopfli on %u bytes", j->inp->len);
+			return;
+		}
+		e.until = t0 + share;
+		if(e.until > z->opt->deadline)
+			e.until = z->opt->deadline;
+	}
+
+	if(zcompress(j, &zb, &e)) {
+		if(zb.len < j->out->len) {
+			my_free(j->out->ptr);
+			*j->out = zb;
+			if(e.unverified)
+				verify_later(z->checks, j->out, j->inp);
+		} else
+			my_free(zb.ptr);
+	}
+
+	if(z->opt->deadline) {
+		pthread_mutex_lock(&z->lock);
+		rate = (clock_now() - t0) / j->inp->len;
+		if(!e.stopped || rate > z->rate)
+			z->rate = rate;
+		pthread_mutex_unlock(&z->lock);
+	}
+}
+
+static void run_jobs(struct zjobs *z, int n)
+{
+	struct effort e0 = {&comp_zlib}, e = {z->opt->comp, z->opt->zopfli_iter};
+	char t0[16], t[16];
+	int i;
+
+	e.level = z->opt->level;
+
+	// zlib first only if there's anything to improve on it
+	if(!strcmp(e0.comp->tag(t0, &e0), e.comp->tag(t, &e))
+	 || (!z->opt->best && !z->opt->deadline)) {
+		pool_run(compress_job, z, n);
+		return;
+	}
+
+	pool_run(baseline_job, z, n);
+	for(i=0; i<n; i++)
+		if(worth_refining(z, &z->job[i]))
+			z->weight += z->job[i].out->len;
+	z->rate = ZOPFLI_RATE;
+	z->threads = pool_size();
+	pool_run(refine_job, z, n);
+}
+
+/* background checks must be over before anything is freed, even on failure */
+static void compress(struct zjob *jobs, int n, struct options *opt)
+{
+	struct zjobs z = {jobs, opt, 0, PTHREAD_MUTEX_INITIALIZER};
+	struct trap tr, *prev = trap;
+	int status = 0, ok;
+
+	z.checks = verify_start();
+	tr.name = prev ? prev->name : 0;
+	tr.msg = prev ? prev->msg : 0;
+	trap = &tr;
+	if(!setjmp(tr.jb))
+		run_jobs(&z, n);
+	else
+		status = tr.status;
+	trap = prev;
+
+	ok = verify_finish(z.checks);
+	if(status)
+		unwind(status);
+	if(!ok)
+		errx(3,"Zopfli error");
+}
+
+static int cmp_zjob(const void *a, const void *b) {
+	return ((struct zjob*)b)->inp->len - ((struct zjob*)a)->inp->len;
+}
+
+/* same data already compressed for an earlier face of the collection */
+static int share_zbuf(struct ttf *ttf, struct table *t)
+{
+	struct ttf *f;
+	int i;
+	for(f=ttf->prev_face; f; f=f->prev_face)
+		for(i=0; i<f->ntables; i++) {
+			struct table *s = &f->tables[i];
+			if(s->buf.ptr==t->buf.ptr && s->buf.len==t->buf.len && s->zbuf.ptr) {
+				t->zbuf = s->zbuf;
+				t->zshared = 1;
+				return 1;
+			}
+		}
+	return 0;
+}
+
+void gen_woff(struct output *out, struct ttf *ttf, struct options *opt)
 {
-	unsigned woff_size, sfnt_size;
+	unsigned woff_size, sfnt_size, hdr_size;
 	struct buf meta_comp={0};
+	struct zjob *jobs;
 	u32 meta_off, priv_off;
 	u8 *buf, *p;
-	int i;
+	int i, n;
 
-	woff_size = 44 + 20*ttf->ntables;
+	/* compress everything up front, biggest first for the pool's sake */
+	jobs = my_alloc((ttf->ntables+1) * sizeof *jobs);
+	n = 0;
+	for(i=0; i<ttf->ntables; i++) {
+		struct table *t = ttf->tab_pos[i];
+		t->zbuf = t->buf;
+		if(t->buf.len >= MIN_COMPR && !share_zbuf(ttf, t)) {
+			jobs[n].out = &t->zbuf;
+			jobs[n].inp = &t->buf;
+			jobs[n].name = t->name;
+			n++;
+		}
+	}
+	if(ttf->woff_meta.len >= MIN_COMPR) {
+		meta_comp = ttf->woff_meta;
+		jobs[n].out = &meta_comp;
+		jobs[n].inp = &ttf->woff_meta;
+		jobs[n].name = "metadata";
+		n++;
+	}
+	qsort(jobs, n, sizeof *jobs, cmp_zjob);
+	compress(jobs, n, opt);
+	my_free(jobs);
+
+	woff_size = hdr_size = 44 + 20*ttf->ntables;
 	sfnt_size = 12 + 16*ttf->ntables;
 	for(i=0; i<ttf->ntables; i++) {
 		struct table *t = ttf->tab_pos[i];
 		t->pos = woff_size; // remember offset in output file
-		t->zbuf = t->buf;
-		if(t->buf.len >= MIN_COMPR)
-			zlib_compress(&t->zbuf, &t->buf);
 		sfnt_size += t->buf.len+3 & ~3;
 		woff_size += t->zbuf.len+3 & ~3;
 	}
 
 	meta_off = 0;
 	if(ttf->woff_meta.len >= MIN_COMPR) {
-		meta_comp = ttf->woff_meta;
-		zlib_compress(&meta_comp, &ttf->woff_meta);
 		meta_off = woff_size;
 		woff_size += meta_comp.len;
 	}
@@ -47,7 +254,7 @@ void gen_woff(struct buf *out, struct ttf *ttf)
 		woff_size += ttf->woff_priv.len;
 	}
 
-	buf = my_alloc(woff_size);
+	buf = my_alloc(hdr_size);
 
 	p32(buf, 0x774F4646);
 	p32(buf+4, ttf->flavor);
@@ -73,23 +280,21 @@ void gen_woff(struct buf *out, struct ttf *ttf)
 		p += 20;
 	}
 
+	assert(p == buf+hdr_size);
+
+	memset(out, 0, sizeof *out);
+	out_add(out, buf, hdr_size, 1);
 	for(i=0; i<ttf->ntables; i++) {
 		struct table *t = ttf->tab_pos[i];
-		u32 sz = t->zbuf.len;
-		p = append(p, t->zbuf.ptr, sz);
-		while(sz&3) *p++=0, sz++;
-//		if(t->zbuf.ptr != t->buf.ptr)
-//			my_free(t->zbuf.ptr);
+		out_add(out, t->zbuf.ptr, t->zbuf.len, 0);
+		out_pad(out);
 	}
 
 	if(meta_comp.len)
-		p = append(p, meta_comp.ptr, meta_comp.len);
+		out_add(out, meta_comp.ptr, meta_comp.len, meta_comp.ptr != ttf->woff_meta.ptr);
 
 	if(ttf->woff_priv.len)
-		p = append(p, ttf->woff_priv.ptr, ttf->woff_priv.len);
-
-	assert(p == buf+woff_size);
+		out_add(out, ttf->woff_priv.ptr, ttf->woff_priv.len, 0);
 
-	out->ptr = buf;
-	out->len = woff_size;
+	assert(out->len == woff_size);
 }
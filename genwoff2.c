@@ -0,0 +1,512 @@
+/*
+ *	Copyright (C) 2017 Jan Bobrowski <jb@wizard.ae.krakow.pl>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <brotli/encode.h>
+#include "ttf2woff.h"
+
+static int brotli_compress(struct buf *out, struct buf *inp, int mode, int quality)
+{
+	size_t len = BrotliEncoderMaxCompressedSize(inp->len);
+	int lgwin = BROTLI_MIN_WINDOW_BITS;
+	u8 *b;
+
+	if(!len)
+		len = inp->len + 1024;
+	while(lgwin < BROTLI_MAX_WINDOW_BITS && (1u<<lgwin) - 16 < inp->len)
+		lgwin++;
+
+	b = my_alloc(len);
+	if(!BrotliEncoderCompress(quality, lgwin, mode, inp->len, inp->ptr, &len, b))
+		errx(3, "brotli error");
+	out->ptr = b;
+	out->len = len;
+	return len;
+}
+
+static int known_tag(u32 tag)
+{
+	int i;
+	for(i=0; i<63; i++)
+		if(g32((u8*)woff2_known_tags + 4*i) == tag)
+			return i;
+	return 63;
+}
+
+static u8 *put_base128(u8 *p, u32 v)
+{
+	int s = 28;
+	while(s && !(v>>s))
+		s -= 7;
+	for(; s; s -= 7)
+		*p++ = 0x80 | v>>s;
+	*p++ = v & 0x7F;
+	return p;
+}
+
+static void xb255(struct xbuf *xb, unsigned v)
+{
+	xbspace(xb, 3);
+	if(v < 253)
+		*xb->p++ = v;
+	else if(v < 2*253)
+		*xb->p++ = 255, *xb->p++ = v - 253;
+	else if(v < 3*253+3)
+		*xb->p++ = 254, *xb->p++ = v - 2*253;
+	else
+		*xb->p++ = 253, xb->p = p16(xb->p, v);
+}
+
+static void xbput(struct xbuf *xb, u8 *p, unsigned n)
+{
+	xbspace(xb, n);
+	xbcopy(xb, p, n);
+}
+
+/* glyf & loca */
+
+enum {c_WORDS=1, c_SCALE=8, c_MORE=32, c_2SCALE=64, c_MATRIX=128, c_INSTR=256};
+#define COMP_ARG_SIZE(F) (((F)&c_WORDS ? 4 : 2) + ((F)&c_SCALE ? 2 : (F)&c_2SCALE ? 4 : (F)&c_MATRIX ? 8 : 0))
+
+enum {s_NCONT, s_NPTS, s_FLAG, s_GLYPH, s_COMP, s_BBOX, s_INSTR, s_NUM};
+
+static void put_triplet(struct xbuf *xs, int on, int dx, int dy)
+{
+	unsigned ax = dx<0 ? -dx : dx;
+	unsigned ay = dy<0 ? -dy : dy;
+	int sg = (dx>0) + 2*(dy>0);
+	int f, n;
+	u8 b[4];
+
+	if(dx==0 && ay < 1280) {
+		f = (ay>>8<<1) + (dy>0);
+		b[0] = ay, n = 1;
+	} else if(dy==0 && ax < 1280) {
+		f = 10 + (ax>>8<<1) + (dx>0);
+		b[0] = ax, n = 1;
+	} else if(ax <= 64 && ay <= 64) {
+		f = 20 + (ax-1 & 0x30) + (ay-1 >> 2 & 0x0C) + sg;
+		b[0] = (ax-1 & 15)<<4 | (ay-1 & 15), n = 1;
+	} else if(ax <= 768 && ay <= 768) {
+		f = 84 + 12*(ax-1 >> 8) + 4*(ay-1 >> 8) + sg;
+		b[0] = ax-1, b[1] = ay-1, n = 2;
+	} else if(ax < 4096 && ay < 4096) {
+		f = 120 + sg;
+		b[0] = ax>>4, b[1] = ax<<4 | ay>>8, b[2] = ay, n = 3;
+	} else {
+		f = 124 + sg;
+		p16(b, ax), p16(b+2, ay), n = 4;
+	}
+
+	xbspace(&xs[s_FLAG], 1);
+	*xs[s_FLAG].p++ = f | (on ? 0 : 128);
+	xbput(&xs[s_GLYPH], b, n);
+}
+
+static u8 *get_coord(int *dv, int f, u8 *p, u8 *e)
+{
+	if(f & 2) { // short
+		if(p == e) return 0;
+		*dv = f & 16 ? *p++ : -*p++;
+	} else if(f & 16) // same
+		*dv = 0;
+	else {
+		if(p+2 > e) return 0;
+		*dv = (s16)g16(p); p += 2;
+	}
+	return p;
+}
+
+/* Returns 0 if the glyph can't be transformed. */
+static int put_simple(struct xbuf *xs, u8 *bbmp, int gi, u8 *p, u8 *e, int nc, int *xmin)
+{
+	u8 *ends = p + 10, *ins, *fl, *f;
+	int np, ni, i, j, ok = 0;
+	int x, y, bb[4];
+	int *dx, *dy;
+
+	if(e - p < 10 + 2*nc + 2)
+		return 0;
+	np = g16(ends + 2*(nc-1)) + 1;
+	ni = g16(ends + 2*nc);
+	ins = ends + 2*nc + 2;
+	fl = ins + ni;
+	if(fl > e)
+		return 0;
+
+	for(i=0, j=-1; i<nc; i++) {
+		int k = g16(ends + 2*i);
+		if(k < j)
+			return 0;
+		j = k;
+	}
+
+	f = my_alloc(np);
+	dx = my_alloc(2*np * sizeof *dx);
+	dy = dx + np;
+
+	for(i=0; i<np;) {
+		int v, r = 1;
+		if(fl == e) goto bad;
+		v = *fl++;
+		if(v & 8) {
+			if(fl == e) goto bad;
+			r += *fl++;
+		}
+		if(i + r > np) goto bad;
+		memset(f+i, v, r);
+		i += r;
+	}
+	for(i=0; i<np; i++)
+		if(!(fl = get_coord(&dx[i], f[i], fl, e))) goto bad;
+	for(i=0; i<np; i++)
+		if(!(fl = get_coord(&dy[i], f[i]>>1, fl, e))) goto bad;
+
+	xbspace(&xs[s_NCONT], 2);
+	xb16(&xs[s_NCONT], nc);
+	for(i=0, j=-1; i<nc; i++) {
+		int k = g16(ends + 2*i);
+		xb255(&xs[s_NPTS], k - j);
+		j = k;
+	}
+
+	x = y = 0;
+	bb[0] = bb[1] = 32767; bb[2] = bb[3] = -32768;
+	for(i=0; i<np; i++) {
+		put_triplet(xs, f[i] & 1, dx[i], dy[i]);
+		x += dx[i], y += dy[i];
+		if(bb[0] > x) bb[0] = x;
+		if(bb[1] > y) bb[1] = y;
+		if(bb[2] < x) bb[2] = x;
+		if(bb[3] < y) bb[3] = y;
+	}
+	xb255(&xs[s_GLYPH], ni);
+	xbput(&xs[s_INSTR], ins, ni);
+
+	for(i=0; i<4; i++)
+		if((s16)g16(p+2+2*i) != bb[i])
+			break;
+	if(i < 4) {
+		bbmp[gi>>3] |= 128 >> (gi&7);
+		xbput(&xs[s_BBOX], p+2, 8);
+	}
+	*xmin = (s16)g16(p+2);
+	ok = 1;
+bad:
+	my_free(f);
+	my_free(dx);
+	return ok;
+}
+
+static int put_composite(struct xbuf *xs, u8 *bbmp, int gi, u8 *p, u8 *e, int *xmin)
+{
+	u8 *c = p + 10, *q = c;
+	int f, ff = 0, ni = 0;
+
+	do {
+		if(e - q < 6)
+			return 0;
+		f = g16(q);
+		q += 4 + COMP_ARG_SIZE(f);
+		if(q > e)
+			return 0;
+		ff |= f;
+	} while(f & c_MORE);
+	if(ff & c_INSTR) {
+		if(q + 2 > e)
+			return 0;
+		ni = g16(q);
+		if(q + 2 + ni > e)
+			return 0;
+	}
+
+	xbspace(&xs[s_NCONT], 2);
+	xb16(&xs[s_NCONT], 0xFFFF);
+	xbput(&xs[s_COMP], c, q - c);
+	if(ff & c_INSTR) {
+		xb255(&xs[s_GLYPH], ni);
+		xbput(&xs[s_INSTR], q + 2, ni);
+	}
+	bbmp[gi>>3] |= 128 >> (gi&7);
+	xbput(&xs[s_BBOX], p+2, 8);
+	*xmin = (s16)g16(p+2);
+	return 1;
+}
+
+/*
+ * Transform 0 of glyf (see reconstruct_3_glyf). xmin[] gets each
+ * glyph's xMin, for the hmtx transform.
+ */
+static int transform_glyf(struct buf *out, struct ttf *ttf, int **xminp, int *ngp)
+{
+	struct table *head, *glyf, *loca;
+	struct xbuf xs[s_NUM];
+	u8 *bbmp = 0;
+	int *xmin = 0;
+	int ng, loca_fmt, bblen;
+	int i, ok = 0;
+
+	head = find_table(ttf, "head");
+	glyf = find_table(ttf, "glyf");
+	loca = find_table(ttf, "loca");
+	if(!head || !glyf || !loca || head->buf.len < 54)
+		return 0;
+	loca_fmt = g16(head->buf.ptr+50);
+	if(loca_fmt > 1)
+		return 0;
+	ng = (loca->buf.len >> 1+loca_fmt) - 1;
+	if(ng < 0 || ng > 0xFFFF)
+		return 0;
+
+	memset(xs, 0, sizeof xs);
+	bblen = ng+31 >> 5 << 2;
+	bbmp = my_alloc(bblen);
+	memset(bbmp, 0, bblen);
+	xmin = my_alloc((ng+1) * sizeof *xmin);
+
+	for(i=0; i<ng; i++) {
+#define read_LOCA(I) (loca_fmt ? g32(loca->buf.ptr + 4*(I)) : g16(loca->buf.ptr + 2*(I)) << 1)
+		unsigned o0 = read_LOCA(i);
+		unsigned o1 = read_LOCA(i+1);
+		u8 *p, *e;
+		int nc;
+
+		if(o1 < o0 || glyf->buf.len < o1)
+			goto done;
+		p = glyf->buf.ptr + o0;
+		e = glyf->buf.ptr + o1;
+		xmin[i] = 0;
+		nc = p == e ? 0 : e - p < 10 ? -2 : g16(p);
+
+		if(nc == 0) {
+			xbspace(&xs[s_NCONT], 2);
+			xb16(&xs[s_NCONT], 0);
+		} else if(nc == 0xFFFF) {
+			if(!put_composite(xs, bbmp, i, p, e, &xmin[i]))
+				goto done;
+		} else if(nc > 0 && nc < 0x8000) {
+			if(!put_simple(xs, bbmp, i, p, e, nc, &xmin[i]))
+				goto done;
+		} else
+			goto done;
+	}
+
+	{
+		u8 *q;
+		unsigned len = 36 + bblen;
+		for(i=0; i<s_NUM; i++)
+			len += XB_LENGTH(xs[i]);
+		out->ptr = q = my_alloc(out->len = len);
+		q = p16(q, 0); // reserved
+		q = p16(q, 0); // optionFlags
+		q = p16(q, ng);
+		q = p16(q, loca_fmt);
+		for(i=0; i<s_NUM; i++)
+			q = p32(q, XB_LENGTH(xs[i]) + (i==s_BBOX ? bblen : 0));
+		for(i=0; i<s_NUM; i++) {
+			if(i==s_BBOX)
+				q = append(q, bbmp, bblen);
+			q = append(q, xs[i].buf.ptr, XB_LENGTH(xs[i]));
+		}
+		assert(q == out->ptr + out->len);
+	}
+	ok = 1;
+
+done:
+	for(i=0; i<s_NUM; i++)
+		my_free(xs[i].buf.ptr);
+	my_free(bbmp);
+	if(ok) {
+		*xminp = xmin;
+		*ngp = ng;
+	} else
+		my_free(xmin);
+	return ok;
+}
+
+/* hmtx: transform 1, left side bearings equal to xMin are dropped */
+
+static int transform_hmtx(struct buf *out, struct ttf *ttf, int *xmin, int ng)
+{
+	struct table *hhea, *hmtx;
+	int nlhm, i, fl;
+	u8 *p, *q;
+
+	hhea = find_table(ttf, "hhea");
+	hmtx = find_table(ttf, "hmtx");
+	if(!hhea || !hmtx || hhea->buf.len < 36)
+		return 0;
+	nlhm = g16(hhea->buf.ptr + 34);
+	if(!nlhm || nlhm > ng || hmtx->buf.len != 4*nlhm + 2*(ng-nlhm))
+		return 0;
+
+	p = hmtx->buf.ptr;
+	fl = 3;
+	for(i=0; i<nlhm; i++)
+		if((s16)g16(p+4*i+2) != xmin[i])
+			fl &= ~1;
+	for(; i<ng; i++)
+		if((s16)g16(p+4*nlhm+2*(i-nlhm)) != xmin[i])
+			fl &= ~2;
+	if(!fl)
+		return 0;
+
+	out->len = 1 + 2*nlhm + (fl&1 ? 0 : 2*nlhm) + (fl&2 ? 0 : 2*(ng-nlhm));
+	out->ptr = q = my_alloc(out->len);
+	*q++ = fl;
+	for(i=0; i<nlhm; i++)
+		q = append(q, p+4*i, 2);
+	if(!(fl&1))
+		for(i=0; i<nlhm; i++)
+			q = append(q, p+4*i+2, 2);
+	if(!(fl&2))
+		q = append(q, p+4*nlhm, 2*(ng-nlhm));
+	assert(q == out->ptr + out->len);
+	return 1;
+}
+
+/* Set "lossless modifying transform" flag before checksums are made. */
+void prepare_woff2(struct ttf *ttf)
+{
+	struct table *head = find_table(ttf, "head");
+	if(head && head->buf.len >= 54 && !(head->buf.ptr[16] & 8)) {
+		head->buf.ptr[16] |= 8; // flags bit 11
+		head->modified = 1;
+	}
+}
+
+struct brotli_arg {
+	struct buf z[4]; // stream, compressed, meta, compressed meta
+	int quality;
+};
+
+static void brotli_job(void *arg, int i)
+{
+	struct brotli_arg *j = arg;
+	struct buf *b = j->z + 2*i;
+	brotli_compress(b+1, b, i ? BROTLI_MODE_TEXT : BROTLI_MODE_FONT, j->quality);
+}
+
+void gen_woff2(struct output *out, struct ttf *ttf, int quality)
+{
+	struct table **dir;
+	struct buf *data;
+	struct brotli_arg bj = {{{0}}, quality};
+	struct buf *z = bj.z;
+	struct buf tglyf = {0}, thmtx = {0};
+	int *xmin = 0;
+	int ng, i, n;
+	u32 sfnt_size, hdr_size, stream_len;
+	u8 *hdr, *p;
+
+	/* directory order: by tag, loca right after glyf */
+	dir = my_alloc(ttf->ntables * sizeof *dir);
+	data = my_alloc(ttf->ntables * sizeof *data);
+	for(i=n=0; i<ttf->ntables; i++) {
+		struct table *t = &ttf->tables[i];
+		if(t->tag == g32("loca"))
+			continue;
+		dir[n++] = t;
+		if(t->tag == g32("glyf")) {
+			struct table *loca = find_table(ttf, "loca");
+			if(loca)
+				dir[n++] = loca;
+		}
+	}
+	if(n != ttf->ntables) // loca without glyf
+		dir[n++] = find_table(ttf, "loca");
+
+	if(transform_glyf(&tglyf, ttf, &xmin, &ng)) {
+		transform_hmtx(&thmtx, ttf, xmin, ng);
+		my_free(xmin);
+	}
+
+	hdr_size = 48;
+	sfnt_size = 12 + 16*ttf->ntables;
+	stream_len = 0;
+	for(i=0; i<n; i++) {
+		struct table *t = dir[i];
+		data[i] = t->buf;
+		hdr_size += 1 + 5;
+		if(known_tag(t->tag) == 63)
+			hdr_size += 4;
+		if(tglyf.ptr && t->tag == g32("glyf"))
+			data[i] = tglyf, hdr_size += 5;
+		else if(tglyf.ptr && t->tag == g32("loca"))
+			data[i].len = 0, hdr_size += 1;
+		else if(thmtx.ptr && t->tag == g32("hmtx"))
+			data[i] = thmtx, hdr_size += 5;
+		stream_len += data[i].len;
+		sfnt_size += t->buf.len+3 & ~3;
+	}
+
+	z[0].ptr = p = my_alloc(z[0].len = stream_len);
+	for(i=0; i<n; i++)
+		p = append(p, data[i].ptr, data[i].len);
+	z[2] = ttf->woff_meta;
+	pool_run(brotli_job, &bj, z[2].len ? 2 : 1);
+	my_free(z[0].ptr);
+	my_free(tglyf.ptr);
+	my_free(thmtx.ptr);
+
+	/* directory */
+	hdr = my_alloc(hdr_size);
+	p = hdr + 48;
+	for(i=0; i<n; i++) {
+		struct table *t = dir[i];
+		int kt = known_tag(t->tag);
+		int tv = 0, tl = 0;
+		if(t->tag == g32("glyf") || t->tag == g32("loca"))
+			tv = tglyf.ptr ? 0 : 3, tl = !tv;
+		else if(t->tag == g32("hmtx") && thmtx.ptr)
+			tv = 1, tl = 1;
+		*p++ = kt | tv<<6;
+		if(kt == 63)
+			p = p32(p, t->tag);
+		p = put_base128(p, t->buf.len);
+		if(tl)
+			p = put_base128(p, data[i].len);
+	}
+	assert(p <= hdr + hdr_size);
+	hdr_size = p - hdr;
+
+	memset(out, 0, sizeof *out);
+	out_add(out, hdr, hdr_size, 1);
+	out_add(out, z[1].ptr, z[1].len, 1);
+	out_pad(out);
+
+	p32(hdr, g32("wOF2"));
+	p32(hdr+4, ttf->flavor);
+	p16(hdr+12, ttf->ntables);
+	p16(hdr+14, 0);
+	p32(hdr+16, sfnt_size);
+	p32(hdr+20, z[1].len);
+	p32(hdr+24, 0); // version
+	p32(hdr+28, 0);
+	p32(hdr+32, 0);
+	p32(hdr+36, 0);
+	if(z[2].len) {
+		p32(hdr+28, out->len);
+		p32(hdr+32, z[3].len);
+		p32(hdr+36, z[2].len);
+		out_add(out, z[3].ptr, z[3].len, 1);
+	}
+	p32(hdr+40, 0);
+	p32(hdr+44, ttf->woff_priv.len);
+	if(ttf->woff_priv.len) {
+		out_pad(out);
+		p32(hdr+40, out->len);
+		out_add(out, ttf->woff_priv.ptr, ttf->woff_priv.len, 0);
+	}
+	p32(hdr+8, out->len);
+
+	my_free(dir);
+	my_free(data);
+}
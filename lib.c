@@ -0,0 +1,227 @@
+/*
+ *	Copyright (C) 2013-2017 Jan Bobrowski <jb@wizard.ae.krakow.pl>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "ttf2woff.h"
+#include "libttf2woff.h"
+
+/*
+ * Library interface. Every call runs under a trap which collects the
+ * error message, so failures come back as status codes (the errx()
+ * status) and never terminate the process.
+ */
+
+struct ttf2woff {
+	char error[TRAP_MSG];
+};
+
+static int catch(struct ttf2woff *ctx, void (*fn)(void *arg), void *arg)
+{
+	struct trap tr, *prev = trap;
+	int status = 0;
+
+	tr.name = 0;
+	tr.msg = ctx->error;
+	ctx->error[0] = 0;
+	trap = &tr;
+	if(!setjmp(tr.jb))
+		fn(arg);
+	else
+		status = tr.status;
+	trap = prev;
+	return status;
+}
+
+static int invalid(struct ttf2woff *ctx, char *what)
+{
+	snprintf(ctx->error, sizeof ctx->error, "Invalid %s", what);
+	return TTF2WOFF_INVALID;
+}
+
+void ttf2woff_default_options(struct ttf2woff_options *opt)
+{
+	memset(opt, 0, sizeof *opt);
+	opt->optimize = -1;
+	opt->brotli_quality = 11;
+	opt->compressor = "zopfli";
+	opt->zopfli_iterations = 15;
+	opt->verify = TTF2WOFF_VERIFY_BACKGROUND;
+}
+
+struct setup {
+	int threads;
+	const char *cache_dir;
+};
+
+static void setup(void *arg)
+{
+	struct setup *s = arg;
+	pool_init(s->threads);
+	if(s->cache_dir) {
+		int l = strlen(s->cache_dir) + 1;
+		char *dir = my_alloc(l);
+		memcpy(dir, s->cache_dir, l);
+		zcache_init(dir);
+	}
+}
+
+struct ttf2woff *ttf2woff_new(int threads, const char *cache_dir)
+{
+	struct ttf2woff *ctx = malloc(sizeof *ctx);
+	struct setup s = {threads, cache_dir};
+
+	if(ctx && catch(ctx, setup, &s)) {
+		free(ctx);
+		ctx = 0;
+	}
+	return ctx;
+}
+
+void ttf2woff_free(struct ttf2woff *ctx)
+{
+	free(ctx);
+}
+
+struct conversion {
+	const struct ttf2woff_options *o;
+	const void *data;
+	size_t len;
+	struct options opt;
+	struct arena *arena;
+	struct ttf *face;
+	struct output out;
+	u8 *result;
+};
+
+static void convert(void *arg)
+{
+	struct conversion *c = arg;
+	const char *const *r;
+	u8 *p;
+	int i;
+
+	arena = c->arena = arena_new();
+	if(c->opt.budget)
+		c->opt.deadline = clock_now() + c->opt.budget;
+
+	for(r = c->o->remove; r && *r; r++) {
+		int l = strlen(*r) + 1;
+		c->opt.xtab.ptr = my_realloc(c->opt.xtab.ptr, c->opt.xtab.len+l);
+		memcpy(c->opt.xtab.ptr+c->opt.xtab.len, *r, l);
+		c->opt.xtab.len += l;
+	}
+
+	// readers patch head and hhea in place
+	p = my_alloc(c->len);
+	memcpy(p, c->data, c->len);
+
+	read_font(&c->face, p, c->len, c->o->font_number);
+	make_font(&c->out, c->face, &c->opt);
+
+	// outlives the arena
+	c->result = p = malloc(c->out.len ? c->out.len : 1);
+	if(!p) errx(1,"Out of memory");
+	for(i=0; i<c->out.n; i++)
+		p = append(p, c->out.piece[i].buf.ptr, c->out.piece[i].buf.len);
+}
+
+int ttf2woff_convert(struct ttf2woff *ctx, const void *data, size_t len,
+	const struct ttf2woff_options *opt, void **out, size_t *out_len)
+{
+	struct ttf2woff_options def;
+	struct conversion c = {0};
+	struct arena *prev = arena;
+	int status;
+
+	if(!opt) {
+		ttf2woff_default_options(&def);
+		opt = &def;
+	}
+	if(!data || len > 1u<<31)
+		return invalid(ctx, "input");
+	if(opt->format < TTF2WOFF_DEFAULT || opt->format > TTF2WOFF_WOFF2)
+		return invalid(ctx, "format");
+	if(opt->optimize < -1 || opt->optimize > 1)
+		return invalid(ctx, "optimize setting");
+	if(opt->font_number < 0)
+		return invalid(ctx, "font number");
+	if(opt->brotli_quality < 0 || opt->brotli_quality > 11)
+		return invalid(ctx, "compression level");
+	c.opt.comp = &comp_zopfli;
+	if(opt->compressor && strcmp(opt->compressor,"best")==0)
+		c.opt.best = 1;
+	else if(opt->compressor && !(c.opt.comp = find_compressor((char*)opt->compressor)))
+		return invalid(ctx, "compressor");
+	if(opt->zopfli_iterations < 0 || opt->zopfli_iterations > 1000)
+		return invalid(ctx, "number of iterations");
+	if(opt->deflate_level < 0 || opt->deflate_level > 12)
+		return invalid(ctx, "compression level");
+	if(opt->zopfli_cache_mb < 0 || opt->zopfli_cache_mb > 4095)
+		return invalid(ctx, "cache size");
+	if(!(opt->time_budget >= 0))
+		return invalid(ctx, "time budget");
+	if(opt->verify < TTF2WOFF_VERIFY_OFF || opt->verify > TTF2WOFF_VERIFY_BACKGROUND)
+		return invalid(ctx, "verification mode");
+	if(opt->metadata_len > 1u<<31 || opt->private_len > 1u<<31)
+		return invalid(ctx, "metadata");
+
+	c.o = opt;
+	c.data = data;
+	c.len = len;
+	c.opt.otype = opt->format ? opt->format : fmt_WOFF;
+	c.opt.mayoptim = opt->optimize != 0;
+	c.opt.optimize = opt->optimize > 0;
+	c.opt.brotli_q = opt->brotli_quality;
+	c.opt.zopfli_iter = opt->zopfli_iterations;
+	c.opt.level = opt->deflate_level;
+	c.opt.zopfli_cache = opt->zopfli_cache_mb;
+	c.opt.budget = opt->time_budget;
+	c.opt.verify = opt->verify;
+	c.opt.meta.ptr = (u8*)opt->metadata;
+	c.opt.meta.len = opt->metadata ? opt->metadata_len : 0;
+	c.opt.priv.ptr = (u8*)opt->private_data;
+	c.opt.priv.len = opt->private_data ? opt->private_len : 0;
+
+	stats = g.stats ? stats_new() : 0; // server -T
+	status = catch(ctx, convert, &c);
+	stats_report(stats, 0, status);
+	stats = 0;
+	arena = prev;
+	arena_free(c.arena); // everything else the conversion allocated
+
+	if(!status) {
+		*out = c.result;
+		*out_len = c.out.len;
+	}
+	return status;
+}
+
+void ttf2woff_free_output(void *out)
+{
+	free(out);
+}
+
+const char *ttf2woff_error(struct ttf2woff *ctx)
+{
+	return ctx->error;
+}
+
+const char *ttf2woff_strerror(int code)
+{
+	static const char *const msg[] = {
+		"Success",
+		"Conversion failed",
+		"Bad font",
+		"Compression failed",
+		"Invalid argument"
+	};
+	if(code < 0 || code >= sizeof msg / sizeof *msg)
+		return "Unknown error";
+	return msg[code];
+}
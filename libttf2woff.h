@@ -0,0 +1,90 @@
+/*
+ *	Copyright (C) 2013-2017 Jan Bobrowski <jb@wizard.ae.krakow.pl>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+
+#ifndef LIBTTF2WOFF_H
+#define LIBTTF2WOFF_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * In-memory font conversion. A context may be used by one thread at
+ * a time; separate contexts may convert concurrently. Worker threads
+ * and the compression cache are shared by the whole process.
+ */
+
+enum {
+	TTF2WOFF_OK = 0,
+	TTF2WOFF_ERROR = 1,		/* out of memory, unsupported feature etc. */
+	TTF2WOFF_BAD_FONT = 2,		/* malformed or truncated input */
+	TTF2WOFF_COMPRESSION = 3,	/* compressor failed */
+	TTF2WOFF_INVALID = 4		/* bad arguments */
+};
+
+enum {
+	TTF2WOFF_VERIFY_OFF,
+	TTF2WOFF_VERIFY_INLINE,
+	TTF2WOFF_VERIFY_BACKGROUND	/* default */
+};
+
+enum {
+	TTF2WOFF_DEFAULT = 0,		/* WOFF */
+	TTF2WOFF_TTF,
+	TTF2WOFF_WOFF,
+	TTF2WOFF_WOFF2
+};
+
+struct ttf2woff_options {
+	int format;			/* TTF2WOFF_TTF, _WOFF, _WOFF2 */
+	int optimize;			/* -1: unless signed (default), 0: no, 1: yes */
+	int font_number;		/* in a collection */
+	int brotli_quality;		/* WOFF2: 0-11 */
+	const char *compressor;		/* WOFF: "zlib", "zopfli" (default), "best",
+					   "libdeflate" if built with it */
+	int zopfli_iterations;		/* WOFF: 0-1000, 0 for zlib level 9 */
+	int deflate_level;		/* WOFF: libdeflate 1-12, 0: default (12) */
+	int zopfli_cache_mb;		/* WOFF: match cache limit per block,
+					   0-4095 MiB, 0: no limit (default) */
+	double time_budget;		/* WOFF: seconds for compression, 0: no limit */
+	int verify;			/* check zopfli output: TTF2WOFF_VERIFY_* */
+	const char *const *remove;	/* tables to remove, NULL terminated;
+					   also "metadata" and "private" */
+	const void *metadata;		/* WOFF extended metadata (XML) */
+	size_t metadata_len;
+	const void *private_data;	/* WOFF private data */
+	size_t private_len;
+};
+
+struct ttf2woff;
+
+void ttf2woff_default_options(struct ttf2woff_options *opt);
+
+/* threads: 0 for one per CPU; cache_dir may be NULL. NULL on failure. */
+struct ttf2woff *ttf2woff_new(int threads, const char *cache_dir);
+void ttf2woff_free(struct ttf2woff *ctx);
+
+/*
+ * Converts a TTF/OTF, TTC face, WOFF or WOFF2 font. On success *out
+ * is a malloc'd buffer for ttf2woff_free_output(). opt may be NULL.
+ */
+int ttf2woff_convert(struct ttf2woff *ctx, const void *data, size_t len,
+	const struct ttf2woff_options *opt, void **out, size_t *out_len);
+void ttf2woff_free_output(void *out);
+
+/* message of the last failure in ctx */
+const char *ttf2woff_error(struct ttf2woff *ctx);
+const char *ttf2woff_strerror(int code);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -42,43 +42,474 @@ static void optimized(struct table *t, struct buf new)
 	replace_table(t, new.ptr, new.len);
 }
 
-static int overlap(struct buf a, struct buf b)
+/*
+ * name: every string is stored once. This is the greedy merge that
+ * scanned all pairs of strings and started over after each step:
+ * a string lying in another goes first; otherwise the pair with the
+ * longest overlap (the end of one being the start of the other) is
+ * joined, the first such pair in the scan if there are several. The
+ * list starts sorted by length and content, a joined pair takes the
+ * place of the earlier of the two, and the string at the front of the
+ * list never serves as a container nor as the first of a pair, as the
+ * scan skipped it. Instead of rescanning, the overlaps of all pairs are
+ * kept in a table, each string remembers which one overlaps its start
+ * most, and only what a step changes is looked at again. Strings are
+ * compared by polynomial hashes, confirmed with memcmp(). The result is
+ * that of the scan, byte for byte.
+ *
+ * The table takes n² words and the search goes over it all the time,
+ * so it's only done up to NAME_EXACT strings; more are chained (below).
+ */
+
+#define NAME_EXACT 1024
+
+struct nstr {
+	u8 *ptr;
+	unsigned len;
+	u32 *h; // prefix hashes, len+1
+	unsigned live:1;
+	unsigned own:1; // ptr is a joined string
+	int inside; // number of other strings containing this one
+	int best; // string whose end overlaps our start most, or -1
+	unsigned ov; // by that much
+};
+
+struct nlist {
+	struct nstr *s;
+	int n, head; // head: the first live string
+	u32 *pw;
+	u32 *ov; // overlap(a, b) at OV(l,a,b)
+};
+
+#define OV(l,a,b) (l)->ov[(size_t)(b)*(l)->n + (a)]
+
+#define HMUL 0x01000193
+
+/* hash of s->ptr[a..a+n) */
+static inline u32 hash_at(struct nlist *l, struct nstr *s, unsigned a, unsigned n)
+{
+	return s->h[a+n] - s->h[a]*l->pw[n];
+}
+
+static u32 *prefix_hashes(u8 *p, unsigned len)
+{
+	u32 *h = my_alloc((len+1) * sizeof *h);
+	unsigned k;
+	h[0] = 0;
+	for(k=0; k<len; k++)
+		h[k+1] = h[k]*HMUL + p[k];
+	return h;
+}
+
+/* whether b lies in a, at or after offset from, starting before to */
+static int lies_in(struct nlist *l, struct nstr *a, struct nstr *b, unsigned from, unsigned to)
+{
+	u32 v = b->h[b->len];
+	unsigned k;
+	if(b->len > a->len)
+		return 0;
+	if(to > a->len-b->len+1)
+		to = a->len-b->len+1;
+	for(k=from; k<to; k++)
+		if(hash_at(l,a,k,b->len)==v && !memcmp(a->ptr+k, b->ptr, b->len))
+			return 1;
+	return 0;
+}
+
+static int contains(struct nlist *l, int a, int b)
+{
+	return lies_in(l, &l->s[a], &l->s[b], 0, -1);
+}
+
+/* longest end of a that is the start of b */
+static unsigned overlap(struct nlist *l, int ai, int bi)
 {
-	int o = a.len<b.len ? a.len : b.len;
-	while(o) {
-		if(memcmp(a.len-o+a.ptr, b.ptr, o)==0)
+	struct nstr *a = &l->s[ai], *b = &l->s[bi];
+	unsigned o = a->len<b->len ? a->len : b->len;
+	for(; o; o--)
+		if(hash_at(l,a,a->len-o,o)==b->h[o] && !memcmp(a->ptr+a->len-o, b->ptr, o))
 			break;
-		o--;
-	}
 	return o;
 }
 
-static u8 *bufbuf(struct buf a, struct buf b)
+static void find_best(struct nlist *l, int b)
+{
+	int a;
+	l->s[b].best = -1;
+	l->s[b].ov = 0;
+	for(a=l->head+1; a<l->n; a++)
+		if(a!=b && l->s[a].live) {
+			unsigned o = OV(l,a,b);
+			if(o > l->s[b].ov) {
+				l->s[b].best = a;
+				l->s[b].ov = o;
+			}
+		}
+}
+
+static void drop_str(struct nlist *l, int x)
+{
+	struct nstr *s = &l->s[x];
+	if(s->own)
+		my_free(s->ptr);
+	my_free(s->h);
+	s->live = 0;
+}
+
+/* the string in front of the list goes */
+static void next_head(struct nlist *l)
+{
+	int y;
+	while(l->head < l->n && !l->s[l->head].live)
+		l->head++;
+	for(y=l->head; y<l->n; y++)
+		if(l->s[y].live && l->s[y].best==l->head)
+			find_best(l, y);
+}
+
+static void remove_str(struct nlist *l, int x)
 {
-	u8 *p=a.ptr, *e=a.ptr+a.len-b.len;
-	while(p<=e) {
-		if(memcmp(p,b.ptr,b.len)==0)
-			return p;
-		p++;
+	int y;
+	for(y=l->head; y<l->n; y++)
+		if(y!=x && l->s[y].live && l->s[y].inside && contains(l, x, y))
+			l->s[y].inside--;
+	drop_str(l, x);
+	for(y=l->head; y<l->n; y++)
+		if(l->s[y].live && l->s[y].best==x)
+			find_best(l, y);
+	if(x == l->head)
+		next_head(l);
+}
+
+/* the end of a overlaps the start of b by o; the result takes the earlier place */
+static void join_str(struct nlist *l, int a, int b, unsigned o)
+{
+	struct nstr *sa = &l->s[a], *sb = &l->s[b], c;
+	int at = a<b ? a : b, y;
+	unsigned seam = sa->len;
+
+	c.len = sa->len + sb->len - o;
+	c.ptr = my_alloc(c.len);
+	append(append(c.ptr, sa->ptr, sa->len), sb->ptr+o, sb->len-o);
+	c.h = prefix_hashes(c.ptr, c.len);
+	c.live = c.own = 1;
+
+	// only the head may contain a, and b unless b is the head
+	c.inside = sa->inside && at!=l->head && lies_in(l, &l->s[l->head], &c, 0, -1);
+	for(y=l->head; y<l->n; y++) {
+		struct nstr *s = &l->s[y];
+		if(y==a || y==b || !s->live)
+			continue;
+		// lying in b, it lies in c; else it has to span the seam
+		if(b==l->head && s->inside && contains(l, b, y))
+			continue;
+		if(lies_in(l, &c, s, seam+1>s->len ? seam+1-s->len : 0, seam-o))
+			s->inside++;
 	}
-	return 0;
+	drop_str(l, a);
+	drop_str(l, b);
+	l->s[at] = c;
+
+	for(y=l->head; y<l->n; y++) {
+		struct nstr *s = &l->s[y];
+		if(y==at || !s->live)
+			continue;
+		OV(l,at,y) = overlap(l, at, y);
+		OV(l,y,at) = overlap(l, y, at);
+		if(s->best==a || s->best==b)
+			find_best(l, y);
+		else if(at != l->head) {
+			unsigned v = OV(l,at,y);
+			if(v > s->ov || (v && v==s->ov && at < s->best)) {
+				s->best = at;
+				s->ov = v;
+			}
+		}
+	}
+	find_best(l, at);
 }
 
-static int name_cmp_len(const void *va, const void *vb) {
-	struct buf a = *(struct buf*)va;
-	struct buf b = *(struct buf*)vb;
-	int d = a.len - b.len;
-	if(!d) d = memcmp(a.ptr, b.ptr, a.len);
+static int nstr_cmp(const void *va, const void *vb)
+{
+	const struct nstr *a = va, *b = vb;
+	int d = a->len - b->len;
+	if(!d) d = memcmp(a->ptr, b->ptr, a->len);
 	return d;
 }
 
+/*
+ * How many other strings each one lies in; with any, just whether it does.
+ * For each length, the windows of that length of all strings at least
+ * as long are put in a hash table, each window value once, with a list
+ * of the strings having it (a string once) and where.
+ */
+
+struct nwin {
+	u32 v;
+	int first; // entry, or -1: free
+};
+
+struct nent {
+	int s, next;
+	unsigned at;
+};
+
+static void count_inside(struct nlist *l, int any)
+{
+	struct nstr *s = l->s;
+	int n = l->n, i, j, c, ne;
+	struct nwin *w;
+	struct nent *e;
+
+	for(i=0; i<n; i=j) {
+		unsigned len = s[i].len, k, nw = 0, sz = 16, x;
+		for(j=i; j<n && s[j].len==len; j++)
+			s[j].inside = 0;
+		if(!len) {
+			for(c=i; c<j; c++)
+				s[c].inside = any ? n>1 : n-1;
+			continue;
+		}
+		for(c=i; c<n; c++)
+			nw += s[c].len - len + 1;
+		while(sz < 2*nw)
+			sz <<= 1;
+		w = my_alloc(sz * sizeof *w);
+		e = my_alloc(nw * sizeof *e);
+		for(x=0; x<sz; x++)
+			w[x].first = -1;
+		ne = 0;
+		for(c=i; c<n; c++)
+			for(k=0; k+len<=s[c].len; k++) {
+				u32 v = hash_at(l, &s[c], k, len);
+				for(x=v&(sz-1); w[x].first>=0 && w[x].v!=v; x=x+1&(sz-1));
+				if(w[x].first >= 0 && e[w[x].first].s == c)
+					continue;
+				e[ne] = (struct nent){c, w[x].first, k};
+				w[x].v = v;
+				w[x].first = ne++;
+			}
+		for(c=i; c<j; c++) {
+			u32 v = s[c].h[len];
+			int y;
+			for(x=v&(sz-1); w[x].first>=0 && w[x].v!=v; x=x+1&(sz-1));
+			for(y=w[x].first; y>=0; y=e[y].next) {
+				struct nstr *t = &s[e[y].s];
+				if(e[y].s == c)
+					continue;
+				if(memcmp(t->ptr+e[y].at, s[c].ptr, len) && !lies_in(l, t, &s[c], e[y].at+1, -1))
+					continue;
+				s[c].inside++;
+				if(any)
+					break;
+			}
+		}
+		my_free(e);
+		my_free(w);
+	}
+}
+
+/*
+ * Many strings: duplicates and strings lying in others go first, then
+ * the rest are chained greedily, longest overlaps first. For each
+ * length o, the starts of the strings not yet preceded are put in a
+ * hash table, and each string not yet followed looks its end up there;
+ * the first string found follows it, unless that would close a loop.
+ * Strings no longer than o are left out, the list being sorted by
+ * length, so all the lengths together take time in proportion to the
+ * total length of the strings. The result is not that of the scan,
+ * but near it: a few bytes longer or shorter.
+ */
+
+struct nkey {
+	u32 v;
+	int str; // one with that start, or -1: free
+	int first, last; // those not preceded yet, linked by nx
+};
+
+static void chain_names(struct nlist *l)
+{
+	struct nstr *s = l->s;
+	int n = l->n, m, i, j, lo, *nx, *next, *prev, *end;
+	unsigned o, *ov, sz;
+	struct nkey *key;
+
+	// the list is sorted, duplicates are adjacent
+	for(i=m=0; i<n; i++)
+		if(m && s[i].len==s[m-1].len && !memcmp(s[i].ptr, s[m-1].ptr, s[i].len))
+			drop_str(l, i);
+		else
+			s[m++] = s[i];
+	l->n = m;
+	count_inside(l, 1);
+	for(i=j=0; i<m; i++)
+		if(s[i].inside)
+			drop_str(l, i);
+		else
+			s[j++] = s[i];
+	for(i=j; i<n; i++)
+		s[i].live = 0;
+	l->n = n;
+	m = j;
+	if(m < 2)
+		return;
+
+	for(sz=16; sz<2*m; sz<<=1);
+	key = my_alloc(sz * sizeof *key);
+	nx = my_alloc(4 * m * sizeof *nx);
+	next = nx + m;
+	prev = next + m;
+	end = prev + m; // the other end of the chain, at its ends
+	ov = my_alloc(m * sizeof *ov); // with the next one
+	for(i=0; i<m; i++) {
+		next[i] = prev[i] = -1;
+		end[i] = i;
+	}
+
+	lo = m;
+	for(o=s[m-1].len-1; o; o--) {
+		unsigned mask;
+		while(lo && s[lo-1].len > o)
+			lo--;
+		for(mask=16; mask<2*(m-lo); mask<<=1);
+		mask--;
+		for(i=0; i<=mask; i++)
+			key[i].str = -1;
+
+		for(i=lo; i<m; i++) {
+			u32 v = s[i].h[o];
+			struct nkey *k;
+			if(prev[i] >= 0)
+				continue;
+			for(j=v&mask;; j=j+1&mask) {
+				k = &key[j];
+				if(k->str<0 || (k->v==v && !memcmp(s[k->str].ptr, s[i].ptr, o)))
+					break;
+			}
+			nx[i] = -1;
+			if(k->str < 0) {
+				k->v = v;
+				k->str = k->first = i;
+			} else
+				nx[k->last] = i;
+			k->last = i;
+		}
+
+		for(i=lo; i<m; i++) {
+			struct nstr *a = &s[i];
+			u32 v = hash_at(l, a, a->len-o, o);
+			struct nkey *k;
+			int b, *pb;
+			if(next[i] >= 0)
+				continue;
+			for(j=v&mask; (k=&key[j])->str>=0; j=j+1&mask)
+				if(k->v==v && !memcmp(s[k->str].ptr, a->ptr+a->len-o, o))
+					break;
+			if(k->str < 0)
+				continue;
+			// skipping those preceded meanwhile and the start of our chain
+			for(pb=&k->first; (b=*pb)>=0; ) {
+				if(prev[b] >= 0)
+					*pb = nx[b];
+				else if(b == end[i])
+					pb = &nx[b];
+				else
+					break;
+			}
+			if(b < 0)
+				continue;
+			next[i] = b;
+			prev[b] = i;
+			ov[i] = o;
+			j = end[i];
+			end[j] = end[b];
+			end[end[b]] = j;
+		}
+	}
+	my_free(key);
+
+	// the chains take the place of their first strings
+	for(i=0; i<m; i++) {
+		struct nstr c;
+		u8 *p;
+		if(prev[i]>=0 || next[i]<0)
+			continue;
+		c.len = s[i].len;
+		for(j=i; next[j]>=0; j=next[j])
+			c.len += s[next[j]].len - ov[j];
+		c.ptr = p = my_alloc(c.len);
+		c.h = 0;
+		c.live = c.own = 1;
+		c.inside = 0;
+		p = append(p, s[i].ptr, s[i].len);
+		for(j=i; next[j]>=0; j=next[j]) {
+			p = append(p, s[next[j]].ptr + ov[j], s[next[j]].len - ov[j]);
+			drop_str(l, next[j]);
+		}
+		drop_str(l, i);
+		s[i] = c;
+	}
+	my_free(ov);
+	my_free(nx);
+}
+
+/* leaves the merged strings live, in order */
+static void merge_names(struct nlist *l)
+{
+	int i, x;
+
+	qsort(l->s, l->n, sizeof *l->s, nstr_cmp);
+	for(i=0; i<l->n; i++) {
+		l->s[i].h = prefix_hashes(l->s[i].ptr, l->s[i].len);
+		l->s[i].live = 1;
+		l->s[i].own = 0;
+	}
+	if(l->n > NAME_EXACT) {
+		chain_names(l);
+		return;
+	}
+	l->head = 0;
+	count_inside(l, 0);
+	l->ov = my_alloc((size_t)l->n * l->n * sizeof *l->ov);
+	for(i=0; i<l->n; i++)
+		for(x=0; x<l->n; x++)
+			OV(l,x,i) = x==i ? 0 : overlap(l, x, i);
+	for(i=0; i<l->n; i++)
+		find_best(l, i);
+
+	for(;;) {
+		int b = -1;
+		for(x=l->head; x<l->n; x++) {
+			struct nstr *s = &l->s[x];
+			if(!s->live || !s->inside)
+				continue;
+			// the head doesn't count as a container
+			if(x==l->head || s->inside>1 || !contains(l, l->head, x))
+				break;
+		}
+		if(x < l->n) {
+			remove_str(l, x);
+			continue;
+		}
+		for(x=l->head; x<l->n; x++)
+			if(l->s[x].live && l->s[x].ov && (b<0 || l->s[x].ov > l->s[b].ov))
+				b = x;
+		if(b < 0)
+			break;
+		join_str(l, l->s[b].best, b, l->s[b].ov);
+	}
+	my_free(l->ov);
+}
+
 static void optimize_name(struct ttf *ttf)
 {
 	struct table *name = find_table(ttf, "name");
 	struct buf str, new;
-	struct buf *ent;
-	u8 *p;
+	struct nlist l;
+	u8 *p, *out;
+	u32 *oh;
 	int count,n,i;
+	unsigned sz, total, k;
 
 	if(!name || name->buf.len<6+2*12+1 || g16(name->buf.ptr))
 		return;
@@ -91,115 +522,87 @@ static void optimize_name(struct ttf *ttf)
 	str.len = name->buf.len-n;
 
 	count = g16(name->buf.ptr+2);
-	if(name->buf.len < 6+12*count) {
+	if(n < 6+12*count) { // strings among the records, or too many of them
 corrupted:
 		echo("Name table corrupted");
 		return;
 	}
 
-	n = count;
-	ent = my_alloc(n * sizeof *ent);
+	l.n = count;
+	l.s = my_alloc(count * sizeof *l.s);
 
+	total = 0;
 	p = name->buf.ptr+6;
-	for(i=0; i<n; i++) {
-		unsigned l = g16(p+8);
-		unsigned o = l ? g16(p+10) : 0;
-		if(o+l > str.len) {
+	for(i=0; i<count; i++) {
+		unsigned len = g16(p+8);
+		unsigned o = len ? g16(p+10) : 0;
+		if(o+len > str.len) {
 			echo("Bad string location in name table");
-			my_free(ent);
+			my_free(l.s);
 			return;
 		}
-		ent[i].ptr = str.ptr + o;
-		ent[i].len = l;
+		l.s[i].ptr = str.ptr + o;
+		l.s[i].len = len;
+		total += len;
 		p += 12;
 	}
 
-	qsort(ent, n, sizeof *ent, name_cmp_len);
-
-	for(;;) {
-		int j,mo,mi,mj;
-		struct buf a, b, c;
-
-		mo = 0;
-		for(j=0;j<n;j++) for(i=1;i<n;i++) if(i!=j) {
-			int o;
-			a = ent[i];
-			b = ent[j];
-			if(bufbuf(a,b))
-				goto remove_b;
-			o = overlap(a,b);
-			if(o > mo) {
-				mo = o;
-				mi = i;
-				mj = j;
-			}
-		}
-		if(!mo)
-			break;
-
-		a = ent[mi];
-		b = ent[mj];
-		c.len = a.len + b.len - mo;
-		c.ptr = my_alloc(c.len);
-		p = append(c.ptr, a.ptr, a.len);
-		append(p, b.ptr+mo, b.len-mo);
-		if(a.ptr<str.ptr || a.ptr>=str.ptr+str.len)
-			my_free(a.ptr);
-
-		i = mi<mj ? mi : mj;
-		j = mi<mj ? mj : mi;
-		ent[i] = c;
-
-remove_b:
-		if(b.ptr<str.ptr || b.ptr>=str.ptr+str.len)
-			my_free(b.ptr);
-		n--;
-		while(j < n) ent[j]=ent[j+1], j++;
-	}
-
-	{
-		int sz = 6 + 12*count;
-		for(i=0;i<n;i++)
-			sz += ent[i].len;
+	l.pw = my_alloc((total+1) * sizeof *l.pw);
+	l.pw[0] = 1;
+	for(k=1; k<=total; k++)
+		l.pw[k] = l.pw[k-1] * HMUL;
 
-		if(sz >= name->buf.len) {
-			my_free(ent);
-			return;
-		}
+	merge_names(&l);
 
-		new.len = sz;
-		new.ptr = my_alloc(sz);
+	sz = 0;
+	for(i=0; i<count; i++)
+		if(l.s[i].live)
+			sz += l.s[i].len;
 
-		p = new.ptr + 6 + 12*count;
-		for(i=0;i<n;i++) {
-			struct buf a = ent[i];
-			memcpy(p,a.ptr,a.len); p+=a.len;
-			if(a.ptr<str.ptr || a.ptr>=str.ptr+str.len)
-				my_free(a.ptr);
-		}
-		assert(p == new.ptr+new.len);
+	if(6 + 12*count + sz >= name->buf.len) {
+		for(i=0; i<count; i++)
+			if(l.s[i].live)
+				drop_str(&l, i);
+		my_free(l.pw);
+		my_free(l.s);
+		return;
 	}
 
-	my_free(ent);
-
+	new.len = 6 + 12*count + sz;
+	new.ptr = my_alloc(new.len);
 	memcpy(new.ptr, name->buf.ptr, 6+12*count);
-	p16(new.ptr+4,6+12*count);
+	p16(new.ptr+4, 6+12*count);
 
-	{
-		struct buf newstr;
-
-		newstr.ptr = new.ptr + 6+12*count;
-		newstr.len = new.len - 6+12*count;
-
-		p = new.ptr + 6 + 10;
-		for(i=0;i<count;i++) {
-			struct buf a = {str.ptr+g16(p), g16(p-2)};
-			u8 *s = bufbuf(newstr, a);
-			assert(s);
-			p16(p, s-newstr.ptr);
-			p += 12;
+	out = p = new.ptr + 6+12*count;
+	for(i=0; i<count; i++)
+		if(l.s[i].live) {
+			p = append(p, l.s[i].ptr, l.s[i].len);
+			drop_str(&l, i);
 		}
+	assert(p == new.ptr + new.len);
+	my_free(l.s);
+
+	/* each string where it first occurs */
+	oh = prefix_hashes(out, sz);
+	p = new.ptr + 6;
+	for(i=0; i<count; i++, p+=12) {
+		unsigned len = g16(p+8);
+		u8 *s = str.ptr + g16(p+10);
+		u32 v = 0;
+		if(!len) {
+			p16(p+10, 0);
+			continue;
+		}
+		for(k=0; k<len; k++)
+			v = v*HMUL + s[k];
+		for(k=0; k+len<=sz; k++)
+			if(oh[k+len] - oh[k]*l.pw[len] == v && !memcmp(out+k, s, len))
+				break;
+		assert(k+len <= sz);
+		p16(p+10, k);
 	}
+	my_free(oh);
+	my_free(l.pw);
 
 #ifndef NDEBUG
 	for(i=0; i<count; i++) {
@@ -281,36 +684,60 @@ enum {
 
 static u8 *decode_coord(int *dv, int f, u8 *p, u8 *e);
 
-static void optimize_glyf(struct ttf *ttf)
-{
-	struct table *head, *glyf, *loca;
+/*
+ * Glyphs are re-encoded in chunks on the worker pool, each chunk with
+ * scratch space of its own. Chunk sizes then give the place of each
+ * chunk in the new glyf, where they are copied, again in parallel.
+ */
+
+#define GLYF_CHUNK 1024
+
+struct glyf_job {
+	struct table *glyf, *loca;
+	int ng, loca_fmt, lf;
 	struct buf *glyphs;
-	u8 *flags;
-	struct xbuf coords = {0};
-	struct xbuf glyph = {0};
-	int ng, loca_fmt;
-	int olen[2];
-	int i;
+	struct glyf_chunk {
+		int olen[2];
+		int failed; // line
+		unsigned pos; // in new glyf
+	} *chunk;
+	struct buf new_glyf, new_loca;
+};
 
-	head = find_table(ttf, "head");
-	glyf = find_table(ttf, "glyf");
-	loca = find_table(ttf, "loca");
-	if(!head || !glyf || !loca)
-		return;
+static int own_glyph(struct glyf_job *gj, struct buf *g)
+{
+	struct buf *b = &gj->glyf->buf;
+	return g->ptr < b->ptr || g->ptr >= b->ptr + b->len;
+}
 
-	if(head->buf.len < 54 || g32(head->buf.ptr)!=0x10000 || g16(head->buf.ptr+52))
-		FAILED;
-	loca_fmt = g16(head->buf.ptr+50);
-	if(loca_fmt > 1)
-		FAILED;
+static void drop_glyphs(struct glyf_job *gj, int i, int end)
+{
+	for(; i<end; i++)
+		if(own_glyph(gj, &gj->glyphs[i]))
+			my_free(gj->glyphs[i].ptr);
+}
 
-	ng = (loca->buf.len >> 1+loca_fmt) - 1;
+#define CHUNK_FAILED do {ch->failed = __LINE__; goto failed;} while(0)
+
+static void reencode_glyphs(void *arg, int c)
+{
+	struct glyf_job *gj = arg;
+	struct glyf_chunk *ch = &gj->chunk[c];
+	struct table *glyf = gj->glyf, *loca = gj->loca;
+	struct buf *glyphs = gj->glyphs;
+	int loca_fmt = gj->loca_fmt;
+	int i, start, end;
+	u8 *flags;
+	struct xbuf coords = {0};
+	struct xbuf glyph = {0};
 
-	glyphs = my_alloc(ng * sizeof *glyphs);
 	flags = my_alloc(65536);
-	olen[0] = olen[1] = 0;
+	ch->olen[0] = ch->olen[1] = 0;
+	ch->failed = 0;
 
-	for(i=0; i<ng; i++) {
+	start = c * GLYF_CHUNK;
+	end = start + GLYF_CHUNK < gj->ng ? start + GLYF_CHUNK : gj->ng;
+	for(i=start; i<end; i++) {
 		u8 *p, *e;
 		int nc;
 		{
@@ -318,9 +745,9 @@ static void optimize_glyf(struct ttf *ttf)
 			unsigned o0 = read_LOCA(i);
 			unsigned o1 = read_LOCA(i+1);
 			if(o1 < o0)
-				FAILED;
+				CHUNK_FAILED;
 			if(glyf->buf.len < o1)
-				FAILED;
+				CHUNK_FAILED;
 			p = glyf->buf.ptr + o0;
 			e = glyf->buf.ptr + o1;
 		}
@@ -330,7 +757,7 @@ static void optimize_glyf(struct ttf *ttf)
 		if(p == e)
 			continue;
 		if(e - p < 12)
-			FAILED;
+			CHUNK_FAILED;
 		nc = g16(p);
 		if(nc == 0) {
 			glyphs[i].len = 0;
@@ -339,19 +766,19 @@ static void optimize_glyf(struct ttf *ttf)
 			p += 10;
 			do {
 				if(e - p < 6)
-					FAILED;
+					CHUNK_FAILED;
 				f = g16(p);
 				p += 4 + COMP_ARG_SIZE(f);
 				if(p > e)
-					FAILED;
+					CHUNK_FAILED;
 				ff |= f;
 			} while(f & c_MORE);
 			if(ff & c_INSTR) {
 				if(p + 2 > e)
-					FAILED;
+					CHUNK_FAILED;
 				p += 2 + g16(p);
 				if(p > e)
-					FAILED;
+					CHUNK_FAILED;
 			}
 			glyphs[i].len = p - glyphs[i].ptr;
 		} else { // simple
@@ -359,27 +786,27 @@ static void optimize_glyf(struct ttf *ttf)
 			u8 *fp;
 			p += 10 + 2*nc;
 			if(p + 2 >= e)
-				FAILED;
+				CHUNK_FAILED;
 			np = g16(p - 2) + 1;
 			ni = g16(p); // instr
 			if(p + ni >= e)
-				FAILED;
+				CHUNK_FAILED;
 			p += 2 + ni;
 			fp = flags;
 			for(n=np; n;) {
 				int f, nf=1;
 				if(p == e)
-					FAILED;
+					CHUNK_FAILED;
 				f = *p++;
 				if(f & o_REPEAT) {
 					if(p == e)
-						FAILED;
+						CHUNK_FAILED;
 					nf += *p++;
 					f &= ~o_REPEAT;
 				}
 				n -= nf;
 				if(n < 0)
-					FAILED;
+					CHUNK_FAILED;
 				memset(fp, f, nf); fp += nf;
 			}
 			XB_RESET(coords);
@@ -387,14 +814,14 @@ static void optimize_glyf(struct ttf *ttf)
 				int dx;
 				p = decode_coord(&dx, flags[n], p, e);
 				if(!p)
-					FAILED;
+					CHUNK_FAILED;
 				flags[n] = flags[n]&(o_ON|o_YSHORT|o_YSIGN|o_RESERVED) | ttf_encode_coord(&coords, dx);
 			}
 			for(n=0; n<np; n++) {
 				int dy;
 				p = decode_coord(&dy, flags[n]>>1, p, e);
 				if(!p)
-					FAILED;
+					CHUNK_FAILED;
 				flags[n] = flags[n]&(o_ON|o_XSHORT|o_XSIGN|o_RESERVED) | ttf_encode_coord(&coords, dy) << 1;
 			}
 			glyphs[i].len = p - glyphs[i].ptr;
@@ -419,54 +846,128 @@ static void optimize_glyf(struct ttf *ttf)
 			}
 		}
 
-		olen[1] += glyphs[i].len;
-		olen[0] += glyphs[i].len+1 & ~1;
+		ch->olen[1] += glyphs[i].len;
+		ch->olen[0] += glyphs[i].len+1 & ~1;
+	}
+	if(0) {
+failed:
+		drop_glyphs(gj, start, i);
 	}
 	my_free(flags);
+	my_free(coords.buf.ptr);
 	my_free(glyph.buf.ptr);
+}
+
+static void place_glyphs(void *arg, int c)
+{
+	struct glyf_job *gj = arg;
+	int lf = gj->lf;
+	int i = c * GLYF_CHUNK;
+	int end = i + GLYF_CHUNK < gj->ng ? i + GLYF_CHUNK : gj->ng;
+	u8 *p = gj->new_glyf.ptr + gj->chunk[c].pos;
+
+	for(; i<end; i++) {
+		struct buf *g = &gj->glyphs[i];
+		int o = p - gj->new_glyf.ptr;
+
+		if(lf)
+			p32(gj->new_loca.ptr + 4*i, o);
+		else {
+			assert(!(o&1));
+			p16(gj->new_loca.ptr + 2*i, o>>1);
+		}
+
+		if(g->len) {
+			assert(p+g->len <= gj->new_glyf.ptr+gj->new_glyf.len);
+			p = append(p, g->ptr, g->len);
+			if(lf==0 && g->len&1) *p++ = 0;
+			if(own_glyph(gj, g))
+				my_free(g->ptr);
+		}
+	}
+}
+
+static void optimize_glyf(struct ttf *ttf)
+{
+	struct table *head, *glyf, *loca;
+	struct glyf_job gj;
+	int ng, nch, loca_fmt;
+	int olen[2];
+	int c, failed;
+
+	head = find_table(ttf, "head");
+	glyf = find_table(ttf, "glyf");
+	loca = find_table(ttf, "loca");
+	if(!head || !glyf || !loca)
+		return;
+
+	if(head->buf.len < 54 || g32(head->buf.ptr)!=0x10000 || g16(head->buf.ptr+52))
+		FAILED;
+	loca_fmt = g16(head->buf.ptr+50);
+	if(loca_fmt > 1)
+		FAILED;
+
+	ng = (loca->buf.len >> 1+loca_fmt) - 1;
+	nch = (ng + GLYF_CHUNK-1) / GLYF_CHUNK;
+
+	gj.glyf = glyf;
+	gj.loca = loca;
+	gj.ng = ng;
+	gj.loca_fmt = loca_fmt;
+	gj.glyphs = my_alloc(ng * sizeof *gj.glyphs);
+	gj.chunk = my_alloc(nch * sizeof *gj.chunk);
+
+	pool_run(reencode_glyphs, &gj, nch);
+
+	olen[0] = olen[1] = 0;
+	failed = 0;
+	for(c=0; c<nch; c++) {
+		if(gj.chunk[c].failed && !failed)
+			failed = gj.chunk[c].failed;
+		olen[0] += gj.chunk[c].olen[0];
+		olen[1] += gj.chunk[c].olen[1];
+	}
+	if(failed) {
+		for(c=0; c<nch; c++)
+			if(!gj.chunk[c].failed)
+				drop_glyphs(&gj, c*GLYF_CHUNK, c+1<nch ? (c+1)*GLYF_CHUNK : ng);
+		echo("Optimization failed [%s:%d]", __FILE__, failed);
+		goto done;
+	}
 
 	{
 		int lf = olen[0] >= 1<<17;
 
 		if(olen[lf] < glyf->buf.len || lf < loca_fmt) {
-			struct buf new_glyf, new_loca;
-			new_glyf.ptr = my_alloc(new_glyf.len = olen[lf]);
-			new_loca.ptr = my_alloc(new_loca.len = (ng + 1) << (lf + 1));
-			u8 *p = new_glyf.ptr;
-
-			for(i=0;; i++) {
-				struct buf *g;
-				int o;
-
-				o = p - new_glyf.ptr;
-				if(lf)
-					p32(new_loca.ptr + 4*i, o);
-				else {
-					assert(!(o&1));
-					p16(new_loca.ptr + 2*i, o>>1);
-				}
+			unsigned pos = 0;
 
-				if(i == ng)
-					break;
+			gj.lf = lf;
+			gj.new_glyf.ptr = my_alloc(gj.new_glyf.len = olen[lf]);
+			gj.new_loca.ptr = my_alloc(gj.new_loca.len = (ng + 1) << (lf + 1));
 
-				g = &glyphs[i];
-				if(g->len) {
-					assert(p+g->len <= new_glyf.ptr+new_glyf.len);
-					p = append(p, g->ptr, g->len);
-					if(lf==0 && g->len&1) *p++ = 0;
-					if(g->ptr < glyf->buf.ptr || g->ptr >= glyf->buf.ptr + glyf->buf.len)
-						my_free(g->ptr);
-				}
+			for(c=0; c<nch; c++) {
+				gj.chunk[c].pos = pos;
+				pos += gj.chunk[c].olen[lf];
 			}
-			assert(p - new_glyf.ptr == new_glyf.len);
-			optimized(glyf, new_glyf);
-			optimized(loca, new_loca);
+			pool_run(place_glyphs, &gj, nch);
+			if(lf)
+				p32(gj.new_loca.ptr + 4*ng, pos);
+			else
+				p16(gj.new_loca.ptr + 2*ng, pos>>1);
+
+			assert(pos == gj.new_glyf.len);
+			optimized(glyf, gj.new_glyf);
+			optimized(loca, gj.new_loca);
 			if(lf != loca_fmt) {
 				p16(head->buf.ptr+50, lf);
 				head->modified = 1;
 			}
-		}
+		} else
+			drop_glyphs(&gj, 0, ng);
 	}
+done:
+	my_free(gj.chunk);
+	my_free(gj.glyphs);
 }
 
 static u8 *decode_coord(int *dv, int f, u8 *p, u8 *e) {
@@ -514,9 +1015,108 @@ void fe_flag(struct flag_enc *fe, int f) {
 	fe->n++;
 }
 
+/*
+ * Faces of a collection share tables. A pass whose input tables and
+ * parameter are those already seen in an earlier face takes the results
+ * from there instead of running again.
+ */
+
+static const struct pass {
+	void (*fn)(struct ttf *ttf);
+	char tab[2][5];
+	char par_tab[5]; // parameter: a 16-bit field of another table
+	int par_off;
+} passes[] = {
+	{optimize_name, {"name"}},
+	{optimize_hmtx, {"hmtx"}, "hhea", 34}, // numberOfHMetrics
+	{optimize_glyf, {"glyf", "loca"}, "head", 50}, // indexToLocFormat
+};
+
+struct memo {
+	const struct pass *pass;
+	struct buf src[2], res[2];
+	int par, res_par;
+	struct memo *next;
+};
+
+static int same_buf(struct buf a, struct buf b) {
+	return a.ptr==b.ptr && a.len==b.len;
+}
+
+static struct memo *recall(struct ttf *ttf, const struct pass *ps, struct buf src[2], int par)
+{
+	struct ttf *f;
+	struct memo *m;
+	for(f=ttf->prev_face; f; f=f->prev_face)
+		for(m=f->memo; m; m=m->next)
+			if(m->pass==ps && m->par==par && same_buf(m->src[0],src[0]) && same_buf(m->src[1],src[1]))
+				return m;
+	return 0;
+}
+
 void optimize(struct ttf *ttf)
 {
-	optimize_name(ttf);
-	optimize_hmtx(ttf);
-	optimize_glyf(ttf);
+	const struct pass *ps;
+
+	for(ps=passes; ps<passes+sizeof passes/sizeof *passes; ps++) {
+		struct table *t[2] = {0}, *pt = 0;
+		struct buf src[2] = {{0}};
+		struct memo *m;
+		struct timing tm;
+		int i, par = -1;
+
+		for(i=0; i<2 && ps->tab[i][0]; i++)
+			if((t[i] = find_table(ttf, (char*)ps->tab[i])))
+				src[i] = t[i]->buf;
+		if(ps->par_off) {
+			pt = find_table(ttf, (char*)ps->par_tab);
+			if(pt && pt->buf.len >= ps->par_off+2)
+				par = g16(pt->buf.ptr + ps->par_off);
+			else
+				pt = 0;
+		}
+
+		m = ttf->prev_face ? recall(ttf, ps, src, par) : 0;
+		if(m) {
+			for(i=0; i<2; i++)
+				if(t[i] && !same_buf(m->res[i], src[i])) {
+					if(t[i]->free_buf)
+						my_free(t[i]->buf.ptr);
+					t[i]->buf = m->res[i];
+					t[i]->free_buf = 0;
+					t[i]->modified = 1;
+					if(g.verbose)
+						echo("Shared %s table (%u)", t[i]->name, t[i]->buf.len);
+				}
+			if(pt && m->res_par != par) {
+				p16(pt->buf.ptr + ps->par_off, m->res_par);
+				pt->modified = 1;
+			}
+			continue;
+		}
+
+		stat_start(&tm);
+		ps->fn(ttf);
+		stat_stop(&tm, "optimize", (char*)ps->tab[0], 0);
+
+		m = my_alloc(sizeof *m);
+		m->pass = ps;
+		m->par = par;
+		m->res_par = pt ? g16(pt->buf.ptr + ps->par_off) : -1;
+		for(i=0; i<2; i++) {
+			m->src[i] = src[i];
+			m->res[i] = t[i] ? t[i]->buf : src[i];
+		}
+		m->next = ttf->memo;
+		ttf->memo = m;
+	}
+}
+
+void forget(struct ttf *ttf)
+{
+	while(ttf->memo) {
+		struct memo *m = ttf->memo;
+		ttf->memo = m->next;
+		my_free(m);
+	}
 }
@@ -0,0 +1,107 @@
+/*
+ *	Copyright (C) 2013-2017 Jan Bobrowski <jb@wizard.ae.krakow.pl>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#ifndef WIN32
+#include <sys/uio.h>
+#include <limits.h>
+#endif
+#include "ttf2woff.h"
+
+/*
+ * Generated files are kept as a list of pieces pointing at the table
+ * data where it already is, and go to the file with writev().
+ */
+
+void out_add(struct output *o, u8 *p, unsigned n, int own)
+{
+	struct piece *s;
+	if(!n)
+		return;
+	if(!(o->n & 15))
+		o->piece = my_realloc(o->piece, (o->n+16) * sizeof *o->piece);
+	s = &o->piece[o->n++];
+	s->buf.ptr = p;
+	s->buf.len = n;
+	s->own = own;
+	o->len += n;
+}
+
+void out_pad(struct output *o)
+{
+	static u8 zero[3];
+	out_add(o, zero, -o->len & 3, 0);
+}
+
+void out_free(struct output *o)
+{
+	int i;
+	for(i=0; i<o->n; i++)
+		if(o->piece[i].own)
+			my_free(o->piece[i].buf.ptr);
+	o->piece = my_free(o->piece);
+	o->n = o->len = 0;
+}
+
+#ifndef WIN32
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+void out_write(int fd, struct output *o)
+{
+	struct iovec iov[64];
+	int i = 0;
+	unsigned skip = 0; // already written from piece i
+
+	while(i < o->n) {
+		int n, j;
+		ssize_t v;
+
+		for(n=0; n<64 && n<IOV_MAX && i+n<o->n; n++) {
+			struct buf *b = &o->piece[i+n].buf;
+			iov[n].iov_base = b->ptr;
+			iov[n].iov_len = b->len;
+		}
+		iov[0].iov_base = (u8*)iov[0].iov_base + skip;
+		iov[0].iov_len -= skip;
+
+		v = writev(fd, iov, n);
+		if(v<=0) {
+			if(v) err(1, "write");
+			errx(1, "Short write");
+		}
+
+		for(j=0; j<n && v >= iov[j].iov_len; j++)
+			v -= iov[j].iov_len;
+		skip = j ? v : skip + v;
+		i += j;
+	}
+}
+
+#else
+
+void out_write(int fd, struct output *o)
+{
+	int i;
+	for(i=0; i<o->n; i++) {
+		u8 *p=o->piece[i].buf.ptr, *e=p+o->piece[i].buf.len;
+		do {
+			int v = write(fd, p, e-p);
+			if(v<=0) {
+				if(v) err(1, "write");
+				errx(1, "Short write");
+			}
+			p += v;
+		} while(p < e);
+	}
+}
+
+#endif
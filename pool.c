@@ -0,0 +1,146 @@
+/*
+ *	Copyright (C) 2013-2017 Jan Bobrowski <jb@wizard.ae.krakow.pl>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "ttf2woff.h"
+
+/*
+ * Shared worker pool. pool_run() queues n calls of fn(arg,i) and the
+ * caller takes part in running them, so nested pool_run() from inside
+ * a job cannot starve: whoever waits has already drained its own work.
+ * A job that fails is caught where it ran; pool_run() then unwinds
+ * the caller once all jobs are finished, with the first error message
+ * if the caller collects messages. Jobs allocate from the caller's arena
+ * and count to its stats.
+ */
+
+struct task {
+	void (*fn)(void *arg, int i);
+	void *arg;
+	int n, next, done;
+	int status;
+	char *name, *msg;
+	struct arena *arena;
+	struct stats *stats;
+	struct task *link;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t finished = PTHREAD_COND_INITIALIZER;
+static struct task *queue, **queue_tail = &queue;
+static int nworkers;
+
+static void dequeue(struct task *t)
+{
+	struct task **pp = &queue;
+	while(*pp != t)
+		pp = &(*pp)->link;
+	*pp = t->link;
+	if(queue_tail == &t->link)
+		queue_tail = pp;
+}
+
+/* lock held */
+static void run_one(struct task *t)
+{
+	struct trap tr, *prev = trap;
+	struct arena *prev_arena = arena;
+	struct stats *prev_stats = stats;
+	char msg[TRAP_MSG];
+	int i = t->next++;
+	int status = 0;
+
+	if(t->next == t->n)
+		dequeue(t);
+	pthread_mutex_unlock(&lock);
+	tr.name = t->name;
+	tr.msg = t->msg ? msg : 0;
+	trap = &tr;
+	arena = t->arena;
+	stats = t->stats;
+	if(!setjmp(tr.jb))
+		t->fn(t->arg, i);
+	else
+		status = tr.status;
+	trap = prev;
+	arena = prev_arena;
+	stats = prev_stats;
+	pthread_mutex_lock(&lock);
+	if(status) {
+		if(!t->status && t->msg)
+			strcpy(t->msg, msg);
+		t->status = status;
+	}
+	if(++t->done == t->n)
+		pthread_cond_broadcast(&finished);
+}
+
+static void *worker(void *unused)
+{
+	pthread_mutex_lock(&lock);
+	for(;;) {
+		while(!queue)
+			pthread_cond_wait(&work, &lock);
+		run_one(queue);
+	}
+	return 0;
+}
+
+int pool_init(int n)
+{
+	if(n <= 0) {
+		long v = sysconf(_SC_NPROCESSORS_ONLN);
+		n = v > 0 ? v : 1;
+	}
+	while(nworkers < n-1) {
+		pthread_t th;
+		if(pthread_create(&th, 0, worker, 0))
+			break;
+		pthread_detach(th);
+		nworkers++;
+	}
+	return nworkers + 1;
+}
+
+int pool_size(void)
+{
+	return nworkers + 1;
+}
+
+void pool_run(void (*fn)(void *arg, int i), void *arg, int n)
+{
+	struct task t = {fn, arg, n};
+	int i;
+
+	t.arena = arena;
+	t.stats = stats;
+	if(trap)
+		t.name = trap->name, t.msg = trap->msg;
+
+	if(!nworkers || n < 2) {
+		for(i=0; i<n; i++)
+			fn(arg, i);
+		return;
+	}
+
+	pthread_mutex_lock(&lock);
+	*queue_tail = &t;
+	queue_tail = &t.link;
+	pthread_cond_broadcast(&work);
+	while(t.next < t.n)
+		run_one(&t);
+	while(t.done < t.n)
+		pthread_cond_wait(&finished, &lock);
+	pthread_mutex_unlock(&lock);
+
+	if(t.status)
+		unwind(t.status);
+}
@@ -10,20 +10,68 @@
 #include <stdlib.h>
 #include "ttf2woff.h"
 
-void read_ttc(struct ttf *ttf, u8 *data, size_t length, int fontn)
+static unsigned ttc_count(u8 *data, size_t length)
 {
-	unsigned n, o;
+	unsigned n;
 
 	if(length < 16+12+16) ERR_TRUNCATED;
 
 	n = g32(data+8);
 	if(n > 1<<26 || length < 16+(4+12+16)*n) ERR_TRUNCATED;
 
-	if(fontn<0 || fontn>=n)
-		errx(1, "No font #%d in collection",fontn);
+	return n;
+}
 
-	o = g32(data+12+4*fontn);
+static void read_face(struct ttf *ttf, u8 *data, size_t length, int fontn)
+{
+	unsigned o = g32(data+12+4*fontn);
 	if(o >= length) ERR_TRUNCATED;
 
 	read_ttf(ttf, data, length, o);
 }
+
+void read_ttc(struct ttf *ttf, u8 *data, size_t length, int fontn)
+{
+	unsigned n = ttc_count(data, length);
+
+	if(fontn<0 || fontn>=n)
+		errx(1, "No font #%d in collection",fontn);
+
+	read_face(ttf, data, length, fontn);
+}
+
+/* head and hhea get patched in place, so every face needs its own */
+static void unshare(struct ttf *ttf, char *tag)
+{
+	struct table *t = find_table(ttf, tag);
+	u8 *p;
+	if(!t || t->free_buf)
+		return;
+	p = my_alloc(t->buf.len);
+	memcpy(p, t->buf.ptr, t->buf.len);
+	t->buf.ptr = p;
+	t->free_buf = 1;
+}
+
+int read_ttc_all(struct ttf **faces, u8 *data, size_t length)
+{
+	unsigned n = ttc_count(data, length);
+	struct ttf *f;
+	int i;
+
+	if(!n)
+		errx(1, "Empty collection");
+
+	f = my_alloc(n * sizeof *f);
+	memset(f, 0, n * sizeof *f);
+	*faces = f;
+
+	for(i=0; i<n; i++) {
+		read_face(&f[i], data, length, i);
+		unshare(&f[i], "head");
+		unshare(&f[i], "hhea");
+		if(i)
+			f[i].prev_face = &f[i-1];
+	}
+	return n;
+}
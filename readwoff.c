@@ -81,8 +81,8 @@ void read_woff(struct ttf *ttf, u8 *data, size_t length)
 		t->tag = g32(p);
 		t->csum = g32(p+16);
 		t->pos = off;
-		t->free_buf = 1;
 		t->buf = get_or_inflate(data+off, len, g32(p+12));
+		t->free_buf = t->buf.ptr != data+off;
 		name_table(t);
 		p += 20;
 	}
@@ -15,28 +15,13 @@
 
 #include <stdio.h>
 
-static char woff2_known_tags[] = "cmapheadhheahmtxmaxpnameOS/2postcvt fpgmglyflocaprep"
+char woff2_known_tags[] = "cmapheadhheahmtxmaxpnameOS/2postcvt fpgmglyflocaprep"
  "CFF VORGEBDTEBLCgasphdmxkernLTSHPCLTVDMXvheavmtxBASEGDEFGPOSGSUBEBSCJSTFMATHC"
  "BDTCBLCCOLRCPALSVG sbixacntavarbdatblocbslncvarfdscfeatfmtxfvargvarhstyjustlc"
  "armortmorxopbdproptrakZapfSilfGlatGlocFeatSill";
 
-static int brotli_decompress(struct buf *out, u8 *data, unsigned len)
-{
-	size_t inn = len;
-	const uint8_t* inp = data;
-	size_t outn = out->len;
-	uint8_t* outp = out->ptr;
-	BrotliDecoderResult r;
-
-	r = BrotliDecoderDecompress(inn, inp, &outn, outp);
-	if(r == BROTLI_DECODER_RESULT_SUCCESS) {
-		return outn;
-	}
-	errx(1, "brotli error");
-}
-
-static void reconstruct_3_glyf(struct table *glyf, struct table *loca);
-static void reconstruct_1_hmtx(struct table *hmtx);
+static void reconstruct_3_glyf(struct table *glyf, struct table *loca, struct buf *xmin);
+static void reconstruct_1_hmtx(struct table *hmtx, struct table *hhea, struct buf *xmin);
 
 static u8 *base128(u8 *p, u32 *vp)
 {
@@ -61,9 +46,13 @@ void read_woff2(struct ttf *ttf, u8 *data, size_t length)
 	u8 *p, *end=data+length;
 	int i;
 	u32 tsize;
-	struct buf tbuf;
+	struct buf tbuf, xmin = {0};
 	int tr_allowed;
-	struct table *glyf, *loca, *hmtx;
+	struct table *glyf, *loca, *hmtx, *hhea;
+	BrotliDecoderState *bd;
+	BrotliDecoderResult r;
+	size_t avail_in;
+	const u8 *next_in;
 
 	if(length<=48+20) ERR_TRUNCATED;
 
@@ -123,7 +112,8 @@ void read_woff2(struct ttf *ttf, u8 *data, size_t length)
 			p = base128(p, &tlen);
 			t->buf.len = tlen;
 		}
-		tsize += t->buf.len;
+		if(t != glyf && t != hmtx)
+			tsize += t->buf.len;
 
 		t->modified = 1; // need checksum
 
@@ -132,30 +122,126 @@ void read_woff2(struct ttf *ttf, u8 *data, size_t length)
 
 	if(!!glyf != !!loca) ERR_FONT;
 
-	// tsize - transformed but not compressed
+	if(hmtx && !glyf) ERR_FONT;
+	hhea = find_table(ttf, "hhea");
 
+	/*
+	 * Tables are decoded in order, each straight into its place, and
+	 * rebuilt as soon as what they depend on is in. Transformed glyf and
+	 * hmtx get buffers of their own, released once rebuilt; the rest
+	 * share aux_buf. tsize is the size of the latter.
+	 */
 	tbuf.ptr = my_alloc(tbuf.len = tsize);
-	brotli_decompress(&tbuf, p, end-p);
 	ttf->aux_buf = tbuf;
+	for(i=0; i<ttf->ntables; i++) {
+		struct table *t = &ttf->tables[i];
+		if(t == glyf || t == hmtx) {
+			t->buf.ptr = my_alloc(t->buf.len);
+			t->free_buf = 1;
+		} else {
+			t->buf.ptr = tbuf.ptr;
+			tbuf.ptr += t->buf.len;
+		}
+	}
 
-	p = tbuf.ptr;
+	bd = BrotliDecoderCreateInstance(0, 0, 0);
+	if(!bd)
+		errx(1, "Out of memory");
+	next_in = p;
+	avail_in = end - p;
+	r = BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT;
 	for(i=0; i<ttf->ntables; i++) {
 		struct table *t = &ttf->tables[i];
-		t->buf.ptr = p;
-		p += t->buf.len;
+		size_t avail_out = t->buf.len;
+		u8 *next_out = t->buf.ptr;
+
+		if(t == loca)
+			continue; // empty when transformed, may be rebuilt already
+		while(avail_out) {
+			if(r != BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT)
+				break;
+			r = BrotliDecoderDecompressStream(bd, &avail_in, &next_in,
+				&avail_out, &next_out, 0);
+		}
+		if(avail_out)
+			break;
+
+		if(t == glyf)
+			reconstruct_3_glyf(glyf, loca, hmtx ? &xmin : 0);
+		if(hmtx && xmin.ptr && hhea && hhea - ttf->tables <= i
+		 && hmtx - ttf->tables <= i) {
+			reconstruct_1_hmtx(hmtx, hhea, &xmin);
+			xmin.ptr = my_free(xmin.ptr);
+			hmtx = 0;
+		}
 	}
+	if(r == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT) {
+		size_t avail_out = 0;
+		u8 *next_out = tbuf.ptr;
+		r = BrotliDecoderDecompressStream(bd, &avail_in, &next_in,
+			&avail_out, &next_out, 0);
+	}
+	BrotliDecoderDestroyInstance(bd);
 
-	if(glyf)
-		reconstruct_3_glyf(glyf, loca);
-	if(hmtx)
-		reconstruct_1_hmtx(hmtx);
+	switch(r) {
+	case BROTLI_DECODER_RESULT_SUCCESS:
+		break;
+	case BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT:
+		ERR_TRUNCATED;
+	case BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT:
+		errx(2, "Excess compressed data");
+	default:
+		errx(2, "Brotli error");
+	}
+	if(i < ttf->ntables)
+		ERR_TRUNCATED;
+	if(hmtx) ERR_FONT; // no hhea
 }
 
 /* hmtx */
 
-static void reconstruct_1_hmtx(struct table *hmtx /*, struct table *hhea */)
+/*
+ * Omitted left side bearings are the glyphs' xMin. These were noted
+ * while glyf was being rebuilt, as 16-bit big endian values.
+ */
+static void reconstruct_1_hmtx(struct table *hmtx, struct table *hhea, struct buf *xmin)
 {
-	errx(1, "hmtx reconstruction not implemented");
+	int nglyphs = xmin->len >> 1;
+	int nhm, flags, i;
+	u8 *p, *e, *aw, *lsb, *mlsb;
+
+	if(!hhea || hhea->buf.len < 36) ERR_FONT;
+	nhm = g16(hhea->buf.ptr+34);
+	if(!nhm || nhm > nglyphs) ERR_FONT;
+
+	p = hmtx->buf.ptr;
+	e = p + hmtx->buf.len;
+	if(p == e) ERR_TRUNCATED;
+	flags = *p++;
+	if(!(flags & 3) || flags & ~3) ERR_FONT;
+
+	aw = p; p += 2*nhm;
+	lsb = mlsb = 0;
+	if(!(flags & 1))
+		lsb = p, p += 2*nhm;
+	if(!(flags & 2))
+		mlsb = p, p += 2*(nglyphs-nhm);
+	if(p != e) ERR_FONT;
+
+	p = my_alloc(4*nhm + 2*(nglyphs-nhm));
+	e = p;
+
+	for(i=0; i<nhm; i++) {
+		p = append(p, aw+2*i, 2);
+		p = append(p, lsb ? lsb+2*i : xmin->ptr+2*i, 2);
+	}
+	append(p, mlsb ? mlsb : xmin->ptr+2*nhm, 2*(nglyphs-nhm));
+
+	if(hmtx->free_buf)
+		my_free(hmtx->buf.ptr);
+	hmtx->buf.ptr = e;
+	hmtx->buf.len = 4*nhm + 2*(nglyphs-nhm);
+	hmtx->free_buf = 1;
 }
 
 /* glyf & loca */
@@ -212,7 +298,7 @@ static int r255(struct range *s)
 static void decode_coords(int f, struct range *s, int d[2]);
 static u8 *set_loca(u8 *loca_p, int loca_t, struct xbuf *xb);
 
-static void reconstruct_3_glyf(struct table *glyf, struct table *loca)
+static void reconstruct_3_glyf(struct table *glyf, struct table *loca, struct buf *xmin)
 {
 	struct range cstr, pstr, fstr, gstr, zstr, bstr, istr;
 	struct xbuf out = {0};
@@ -260,6 +346,11 @@ static void reconstruct_3_glyf(struct table *glyf, struct table *loca)
 #define BBMP(N) (bbmp[(N)>>3] & 128>>((N)&7))
 	}
 
+	if(xmin) {
+		xmin->ptr = my_alloc(xmin->len = 2*nglyphs);
+		memset(xmin->ptr, 0, xmin->len);
+	}
+
 	loca->buf.ptr = my_alloc(loca->buf.len = (loca_t?4:2)*(nglyphs + 1));
 	loca->free_buf = 1;
 	loca_p = loca->buf.ptr;
@@ -313,10 +404,6 @@ static void reconstruct_3_glyf(struct table *glyf, struct table *loca)
 				if(yMin > y) yMin = y;
 				if(xMax < x) xMax = x;
 				if(yMax < y) yMax = y;
-				if(g16(ends)==j) {
-					x = y = 0; // ?
-					ends += 2;
-				}
 
 				of = f>>7 ^ 1;
 				of |= ttf_encode_coord(&xcoord, d[0]);
@@ -374,6 +461,8 @@ static void reconstruct_3_glyf(struct table *glyf, struct table *loca)
 			u8 *q = bite(&bstr, 8);
 			memcpy(p, q, 8);
 		}
+		if(xmin)
+			memcpy(xmin->ptr + 2*i, out.buf.ptr + bb_offs, 2);
 	}
 
 	set_loca(loca_p, loca_t, &out);
@@ -382,7 +471,8 @@ static void reconstruct_3_glyf(struct table *glyf, struct table *loca)
 	my_free(xcoord.buf.ptr);
 	my_free(ycoord.buf.ptr);
 
-	assert(!glyf->free_buf);
+	if(glyf->free_buf)
+		my_free(glyf->buf.ptr);
 	glyf->buf.ptr = out.buf.ptr;
 	glyf->buf.len = XB_LENGTH(out);
 	glyf->free_buf = 1;
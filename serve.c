@@ -0,0 +1,329 @@
+/*
+ *	Copyright (C) 2013-2017 Jan Bobrowski <jb@wizard.ae.krakow.pl>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "ttf2woff.h"
+#include "libttf2woff.h"
+
+#ifndef WIN32
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <pthread.h>
+
+/*
+ * Conversion server on a Unix socket. A request is a line
+ *	length [-t fmt] [-O|-S] [-u num] [-Q q] [-c name] [-I n] [-L n] [-M MiB] [-D sec] [-y how] [-X tag]...
+ * followed by length bytes of font; the reply is a line
+ *	status length
+ * followed by the converted font (status 0) or an error message.
+ * A connection may carry any number of requests, one after another.
+ *
+ * Each worker thread serves one connection at a time. Accepted
+ * connections wait in a queue of limited depth; when it is full, the
+ * server stops accepting and further clients wait in the listen backlog.
+ */
+
+#define MAX_LINE 1024
+#define MAX_REMOVE 32
+#define MAX_INPUT (64<<20)
+#define IDLE_TIMEOUT 60
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t ready, room;
+	int *fd;
+	int first, n, max;
+} q = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static int get_full(int fd, void *buf, size_t n)
+{
+	u8 *p = buf;
+	while(n) {
+		ssize_t v = read(fd, p, n);
+		if(v <= 0)
+			return 0;
+		p += v, n -= v;
+	}
+	return 1;
+}
+
+static int put_full(int fd, const void *buf, size_t n)
+{
+	const u8 *p = buf;
+	while(n) {
+		ssize_t v = write(fd, p, n);
+		if(v <= 0)
+			return 0;
+		p += v, n -= v;
+	}
+	return 1;
+}
+
+/* 0 at EOF or on a line that is too long */
+static int get_line(int fd, char *buf, int size)
+{
+	int l;
+	for(l=0; l<size-1; l++) {
+		if(read(fd, buf+l, 1) != 1)
+			return 0;
+		if(buf[l] == '\n') {
+			buf[l] = 0;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int reply(int fd, int status, const void *data, size_t len)
+{
+	char h[32];
+	int l = snprintf(h, sizeof h, "%d %lu\n", status, (unsigned long)len);
+	return put_full(fd, h, l) && put_full(fd, data, len);
+}
+
+/* fills opt from the words of the request line; 0 on a bad request */
+static int parse_request(char *line, size_t *len, struct ttf2woff_options *opt, const char **rm)
+{
+	char *w, *a, *e, *sp;
+	int nrm = 0;
+	long v;
+
+	ttf2woff_default_options(opt);
+	opt->remove = rm;
+	rm[0] = 0;
+
+	w = strtok_r(line, " \t\r", &sp);
+	if(!w)
+		return 0;
+	v = strtol(w, &e, 10);
+	if(*e || v <= 0 || v > MAX_INPUT)
+		return 0;
+	*len = v;
+
+	while((w = strtok_r(0, " \t\r", &sp))) {
+		if(w[0] != '-' || !w[1] || w[2])
+			return 0;
+		if(w[1] == 'O') {
+			opt->optimize = 1;
+			continue;
+		}
+		if(w[1] == 'S') {
+			opt->optimize = 0;
+			continue;
+		}
+		a = strtok_r(0, " \t\r", &sp);
+		if(!a)
+			return 0;
+		switch(w[1]) {
+		case 't':
+			if(strcmp(a,"ttf")==0 || strcmp(a,"otf")==0)
+				opt->format = TTF2WOFF_TTF;
+			else if(strcmp(a,"woff")==0)
+				opt->format = TTF2WOFF_WOFF;
+			else if(strcmp(a,"woff2")==0)
+				opt->format = TTF2WOFF_WOFF2;
+			else
+				return 0;
+			break;
+		case 'u':
+			opt->font_number = strtol(a, &e, 10);
+			if(*e)
+				return 0;
+			break;
+		case 'Q':
+			opt->brotli_quality = strtol(a, &e, 10);
+			if(*e)
+				return 0;
+			break;
+		case 'c':
+			opt->compressor = a;
+			break;
+		case 'I':
+			opt->zopfli_iterations = strtol(a, &e, 10);
+			if(*e)
+				return 0;
+			break;
+		case 'L':
+			opt->deflate_level = strtol(a, &e, 10);
+			if(*e)
+				return 0;
+			break;
+		case 'M':
+			opt->zopfli_cache_mb = strtol(a, &e, 10);
+			if(*e)
+				return 0;
+			break;
+		case 'D':
+			opt->time_budget = strtod(a, &e);
+			if(*e)
+				return 0;
+			break;
+		case 'y':
+			if(strcmp(a,"off")==0)
+				opt->verify = TTF2WOFF_VERIFY_OFF;
+			else if(strcmp(a,"inline")==0)
+				opt->verify = TTF2WOFF_VERIFY_INLINE;
+			else if(strcmp(a,"background")==0)
+				opt->verify = TTF2WOFF_VERIFY_BACKGROUND;
+			else
+				return 0;
+			break;
+		case 'X':
+			if(nrm == MAX_REMOVE)
+				return 0;
+			rm[nrm++] = a;
+			rm[nrm] = 0;
+			break;
+		default:
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void serve_connection(struct ttf2woff *ctx, int fd)
+{
+	struct timeval tv = {IDLE_TIMEOUT};
+	char line[MAX_LINE];
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+	while(get_line(fd, line, sizeof line)) {
+		struct ttf2woff_options opt;
+		const char *rm[MAX_REMOVE+1];
+		void *in, *out;
+		size_t len, out_len;
+		int status;
+
+		if(!parse_request(line, &len, &opt, rm)) {
+			static char msg[] = "Bad request";
+			reply(fd, TTF2WOFF_INVALID, msg, sizeof msg - 1);
+			return;
+		}
+
+		in = malloc(len);
+		if(!in) {
+			static char msg[] = "Out of memory";
+			reply(fd, TTF2WOFF_ERROR, msg, sizeof msg - 1);
+			return;
+		}
+		if(!get_full(fd, in, len)) {
+			free(in);
+			return;
+		}
+
+		status = ttf2woff_convert(ctx, in, len, &opt, &out, &out_len);
+		free(in);
+		if(g.verbose)
+			echo("request: %lu bytes, status %d", (unsigned long)len, status);
+		if(status) {
+			const char *e = ttf2woff_error(ctx);
+			if(!reply(fd, status, e, strlen(e)))
+				return;
+			continue;
+		}
+		status = reply(fd, 0, out, out_len);
+		ttf2woff_free_output(out);
+		if(!status)
+			return;
+	}
+}
+
+static void *serve_worker(void *unused)
+{
+	struct ttf2woff *ctx = ttf2woff_new(1, 0);
+	if(!ctx)
+		errx(1, "Out of memory");
+
+	for(;;) {
+		int fd;
+		pthread_mutex_lock(&q.lock);
+		while(!q.n)
+			pthread_cond_wait(&q.ready, &q.lock);
+		fd = q.fd[q.first];
+		q.first = (q.first + 1) % q.max;
+		q.n--;
+		pthread_cond_signal(&q.room);
+		pthread_mutex_unlock(&q.lock);
+
+		serve_connection(ctx, fd);
+		close(fd);
+	}
+	return 0;
+}
+
+int serve(char *path, int nworkers, int depth)
+{
+	struct sockaddr_un sa = {AF_UNIX};
+	struct stat st;
+	int i, s;
+
+	if(strlen(path) >= sizeof sa.sun_path)
+		errx(1, "Socket path too long: %s", path);
+	strcpy(sa.sun_path, path);
+	if(depth < 1)
+		depth = 1;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(s < 0)
+		err(1, "socket");
+	if(stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path); // left by a previous server
+	if(bind(s, (struct sockaddr*)&sa, sizeof sa) < 0)
+		err(1, "%s", path);
+	if(listen(s, depth) < 0)
+		err(1, "listen");
+
+	q.fd = my_alloc(depth * sizeof *q.fd);
+	q.max = depth;
+
+	for(i=0; i<nworkers; i++) {
+		pthread_t th;
+		if(pthread_create(&th, 0, serve_worker, 0))
+			err(1, "pthread_create");
+		pthread_detach(th);
+	}
+	if(g.verbose)
+		echo("Serving on %s, %d workers, queue %d", path, nworkers, depth);
+
+	for(;;) {
+		int fd;
+		pthread_mutex_lock(&q.lock);
+		while(q.n == q.max)
+			pthread_cond_wait(&q.room, &q.lock);
+		pthread_mutex_unlock(&q.lock);
+
+		fd = accept(s, 0, 0);
+		if(fd < 0) {
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+			err(1, "accept");
+		}
+		pthread_mutex_lock(&q.lock);
+		q.fd[(q.first + q.n++) % q.max] = fd;
+		pthread_cond_signal(&q.ready);
+		pthread_mutex_unlock(&q.lock);
+	}
+}
+
+#else
+
+int serve(char *path, int nworkers, int depth)
+{
+	errx(1, "Server mode is not supported");
+}
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ *	Copyright (C) 2013-2017 Jan Bobrowski <jb@wizard.ae.krakow.pl>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+
+#include <string.h>
+#include "ttf2woff.h"
+
+/* FIPS 180-4 */
+
+static const u32 K[64] = {
+	0x428a2f98,0x71374491,0xb5c0fbcf,0xe9b5dba5,0x3956c25b,0x59f111f1,0x923f82a4,0xab1c5ed5,
+	0xd807aa98,0x12835b01,0x243185be,0x550c7dc3,0x72be5d74,0x80deb1fe,0x9bdc06a7,0xc19bf174,
+	0xe49b69c1,0xefbe4786,0x0fc19dc6,0x240ca1cc,0x2de92c6f,0x4a7484aa,0x5cb0a9dc,0x76f988da,
+	0x983e5152,0xa831c66d,0xb00327c8,0xbf597fc7,0xc6e00bf3,0xd5a79147,0x06ca6351,0x14292967,
+	0x27b70a85,0x2e1b2138,0x4d2c6dfc,0x53380d13,0x650a7354,0x766a0abb,0x81c2c92e,0x92722c85,
+	0xa2bfe8a1,0xa81a664b,0xc24b8b70,0xc76c51a3,0xd192e819,0xd6990624,0xf40e3585,0x106aa070,
+	0x19a4c116,0x1e376c08,0x2748774c,0x34b0bcb5,0x391c0cb3,0x4ed8aa4a,0x5b9cca4f,0x682e6ff3,
+	0x748f82ee,0x78a5636f,0x84c87814,0x8cc70208,0x90befffa,0xa4506ceb,0xbef9a3f7,0xc67178f2
+};
+
+#define ROR(X,N) ((X)>>(N) | (X)<<(32-(N)))
+
+static void sha256_block(u32 h[8], u8 *p)
+{
+	u32 w[64], a,b,c,d,e,f,g,k;
+	int i;
+
+	for(i=0; i<16; i++)
+		w[i] = g32(p+4*i);
+	for(; i<64; i++) {
+		u32 s0 = ROR(w[i-15],7) ^ ROR(w[i-15],18) ^ w[i-15]>>3;
+		u32 s1 = ROR(w[i-2],17) ^ ROR(w[i-2],19) ^ w[i-2]>>10;
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+
+	a=h[0]; b=h[1]; c=h[2]; d=h[3]; e=h[4]; f=h[5]; g=h[6]; k=h[7];
+	for(i=0; i<64; i++) {
+		u32 t1 = k + (ROR(e,6) ^ ROR(e,11) ^ ROR(e,25)) + (e&f ^ ~e&g) + K[i] + w[i];
+		u32 t2 = (ROR(a,2) ^ ROR(a,13) ^ ROR(a,22)) + (a&b ^ a&c ^ b&c);
+		k=g; g=f; f=e; e=d+t1;
+		d=c; c=b; b=a; a=t1+t2;
+	}
+	h[0]+=a; h[1]+=b; h[2]+=c; h[3]+=d; h[4]+=e; h[5]+=f; h[6]+=g; h[7]+=k;
+}
+
+void sha256_init(struct sha256 *s)
+{
+	static const u32 iv[8] = {
+		0x6a09e667,0xbb67ae85,0x3c6ef372,0xa54ff53a,0x510e527f,0x9b05688c,0x1f83d9ab,0x5be0cd19
+	};
+	memcpy(s->h, iv, sizeof iv);
+	s->len = 0;
+}
+
+void sha256_update(struct sha256 *s, const void *data, size_t n)
+{
+	const u8 *p = data;
+	unsigned o = s->len & 63;
+
+	s->len += n;
+	if(o) {
+		unsigned l = 64-o < n ? 64-o : n;
+		memcpy(s->blk+o, p, l);
+		p += l, n -= l;
+		if(o+l < 64)
+			return;
+		sha256_block(s->h, s->blk);
+	}
+	for(; n >= 64; p += 64, n -= 64)
+		sha256_block(s->h, (u8*)p);
+	memcpy(s->blk, p, n);
+}
+
+void sha256_final(struct sha256 *s, u8 md[32])
+{
+	unsigned o = s->len & 63;
+	unsigned long long bits = s->len << 3;
+	int i;
+
+	s->blk[o++] = 0x80;
+	if(o > 56) {
+		memset(s->blk+o, 0, 64-o);
+		sha256_block(s->h, s->blk);
+		o = 0;
+	}
+	memset(s->blk+o, 0, 56-o);
+	p32(s->blk+56, bits>>32);
+	p32(s->blk+60, bits);
+	sha256_block(s->h, s->blk);
+
+	for(i=0; i<8; i++)
+		p32(md+4*i, s->h[i]);
+}
@@ -0,0 +1,194 @@
+/*
+ *	Copyright (C) 2013-2017 Jan Bobrowski <jb@wizard.ae.krakow.pl>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#include "ttf2woff.h"
+
+/*
+ * Instrumentation (-T). While a conversion has stats, its steps add
+ * their wall and CPU time there, summed over repeats of the same step
+ * (faces of a collection, compression passes), and my_alloc() counts
+ * calls and bytes. Pool jobs count to the stats of their caller. CPU
+ * time is that of the thread doing the step; the total adds what other
+ * threads spent on the conversion's steps to the converting thread's.
+ * stats_report() prints it all as one line of JSON on stderr.
+ */
+
+struct step {
+	char *what, *by; // not copied
+	char table[8];
+	double wall, cpu;
+	int n;
+};
+
+struct stats {
+	pthread_mutex_t lock;
+	pthread_t owner;
+	struct timing start;
+	double other_cpu; // of steps run by other threads
+	unsigned long allocs;
+	unsigned long long bytes;
+	struct step *step;
+	int nsteps;
+};
+
+__thread struct stats *stats;
+
+static double cpu_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+struct stats *stats_new(void)
+{
+	struct stats *s = malloc(sizeof *s);
+	if(!s) errx(1,"Out of memory");
+	memset(s, 0, sizeof *s);
+	pthread_mutex_init(&s->lock, 0);
+	s->owner = pthread_self();
+	s->start.wall = clock_now();
+	s->start.cpu = cpu_now();
+	return s;
+}
+
+void stat_alloc(size_t n)
+{
+	__atomic_add_fetch(&stats->allocs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&stats->bytes, n, __ATOMIC_RELAXED);
+}
+
+void stat_start(struct timing *t)
+{
+	if(!stats)
+		return;
+	t->wall = clock_now();
+	t->cpu = cpu_now();
+}
+
+void stat_stop(struct timing *t, char *what, char *table, char *by)
+{
+	struct stats *s = stats;
+	struct step *p;
+	double wall, cpu;
+	int i;
+
+	if(!s)
+		return;
+	wall = clock_now() - t->wall;
+	cpu = cpu_now() - t->cpu;
+	if(!table)
+		table = "";
+
+	pthread_mutex_lock(&s->lock);
+	for(i=0; i<s->nsteps; i++) {
+		p = &s->step[i];
+		if(!strcmp(p->what, what) && !strcmp(p->table, table)
+		 && (p->by==by || (p->by && by && !strcmp(p->by, by))))
+			goto found;
+	}
+	p = realloc(s->step, (s->nsteps+1) * sizeof *p);
+	if(!p) {
+		pthread_mutex_unlock(&s->lock);
+		errx(1,"Out of memory");
+	}
+	s->step = p;
+	p += s->nsteps++;
+	memset(p, 0, sizeof *p);
+	p->what = what;
+	p->by = by;
+	snprintf(p->table, sizeof p->table, "%s", table);
+found:
+	p->wall += wall;
+	p->cpu += cpu;
+	p->n++;
+	if(!pthread_equal(s->owner, pthread_self()))
+		s->other_cpu += cpu;
+	pthread_mutex_unlock(&s->lock);
+}
+
+/* the report is put together first and printed with one call */
+struct line {
+	char *p;
+	size_t len, size;
+};
+
+static void put(struct line *l, char *f, ...)
+{
+	va_list va;
+	int n;
+	for(;;) {
+		va_start(va, f);
+		n = vsnprintf(l->p + l->len, l->size - l->len, f, va);
+		va_end(va);
+		if(n < 0)
+			return;
+		if(l->len + n < l->size)
+			break;
+		l->size = (l->len + n) * 2 + 256;
+		l->p = realloc(l->p, l->size);
+		if(!l->p) errx(1,"Out of memory");
+	}
+	l->len += n;
+}
+
+static void put_str(struct line *l, char *s)
+{
+	put(l, "\"");
+	for(; *s; s++) {
+		if(*s=='"' || *s=='\\')
+			put(l, "\\%c", *s);
+		else if((u8)*s < ' ')
+			put(l, "\\u%04x", (u8)*s);
+		else
+			put(l, "%c", *s);
+	}
+	put(l, "\"");
+}
+
+/* name may be 0 */
+void stats_report(struct stats *s, char *name, int status)
+{
+	struct line l = {0};
+	int i;
+
+	if(!s)
+		return;
+	put(&l, "{");
+	if(name) {
+		put(&l, "\"file\":");
+		put_str(&l, name);
+		put(&l, ",");
+	}
+	put(&l, "\"status\":%d,\"wall\":%.6f,\"cpu\":%.6f,\"allocs\":%lu,\"alloc_bytes\":%llu,\"steps\":[",
+	 status, clock_now() - s->start.wall, cpu_now() - s->start.cpu + s->other_cpu,
+	 s->allocs, s->bytes);
+	for(i=0; i<s->nsteps; i++) {
+		struct step *p = &s->step[i];
+		put(&l, "%s{\"step\":\"%s\"", i ? "," : "", p->what);
+		if(p->table[0]) {
+			put(&l, ",\"table\":");
+			put_str(&l, p->table);
+		}
+		if(p->by)
+			put(&l, ",\"by\":\"%s\"", p->by);
+		put(&l, ",\"n\":%d,\"wall\":%.6f,\"cpu\":%.6f}", p->n, p->wall, p->cpu);
+	}
+	put(&l, "]}\n");
+	fputs(l.p, stderr);
+
+	free(l.p);
+	free(s->step);
+	pthread_mutex_destroy(&s->lock);
+	free(s);
+}
@@ -0,0 +1,265 @@
+/*
+ *	Copyright (C) 2013-2017 Jan Bobrowski <jb@wizard.ae.krakow.pl>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+
+/*
+ * Name table merging against the original pairwise search, on random
+ * tables. Both must give the same table, byte for byte. Tables over
+ * NAME_EXACT strings, chained instead, must keep every string.
+ *
+ *	usage: name [count [seed]]
+ */
+
+#include <stdio.h>
+#include "../optimize.c"
+
+static int old_overlap(struct buf a, struct buf b)
+{
+	int o = a.len<b.len ? a.len : b.len;
+	while(o) {
+		if(memcmp(a.len-o+a.ptr, b.ptr, o)==0)
+			break;
+		o--;
+	}
+	return o;
+}
+
+static u8 *old_bufbuf(struct buf a, struct buf b)
+{
+	u8 *p=a.ptr, *e=a.ptr+a.len-b.len;
+	while(p<=e) {
+		if(memcmp(p,b.ptr,b.len)==0)
+			return p;
+		p++;
+	}
+	return 0;
+}
+
+static int old_cmp_len(const void *va, const void *vb) {
+	struct buf a = *(struct buf*)va;
+	struct buf b = *(struct buf*)vb;
+	int d = a.len - b.len;
+	if(!d) d = memcmp(a.ptr, b.ptr, a.len);
+	return d;
+}
+
+/* the table as the pairwise search left it, or a copy if unchanged */
+static struct buf old_name(struct buf name)
+{
+	struct buf str, new, *ent;
+	u8 *p;
+	int count,n,i;
+
+	n = g16(name.ptr+4);
+	str.ptr = name.ptr+n;
+	str.len = name.len-n;
+	count = g16(name.ptr+2);
+
+	ent = my_alloc(count * sizeof *ent);
+	p = name.ptr+6;
+	for(i=0; i<count; i++) {
+		ent[i].len = g16(p+8);
+		ent[i].ptr = str.ptr + (ent[i].len ? g16(p+10) : 0);
+		p += 12;
+	}
+	qsort(ent, count, sizeof *ent, old_cmp_len);
+
+	for(n=count;;) {
+		int j,mo,mi=0,mj=0;
+		struct buf a, b, c;
+
+		mo = 0;
+		for(j=0;j<n;j++) for(i=1;i<n;i++) if(i!=j) {
+			int o;
+			a = ent[i];
+			b = ent[j];
+			if(old_bufbuf(a,b))
+				goto remove_b;
+			o = old_overlap(a,b);
+			if(o > mo) {
+				mo = o;
+				mi = i;
+				mj = j;
+			}
+		}
+		if(!mo)
+			break;
+
+		a = ent[mi];
+		b = ent[mj];
+		c.len = a.len + b.len - mo;
+		c.ptr = my_alloc(c.len);
+		append(append(c.ptr, a.ptr, a.len), b.ptr+mo, b.len-mo);
+		if(a.ptr<str.ptr || a.ptr>=str.ptr+str.len)
+			my_free(a.ptr);
+
+		i = mi<mj ? mi : mj;
+		j = mi<mj ? mj : mi;
+		ent[i] = c;
+
+remove_b:
+		if(b.ptr<str.ptr || b.ptr>=str.ptr+str.len)
+			my_free(b.ptr);
+		n--;
+		while(j < n) ent[j]=ent[j+1], j++;
+	}
+
+	new.len = 6 + 12*count;
+	for(i=0;i<n;i++)
+		new.len += ent[i].len;
+	if(new.len >= name.len)
+		new.len = name.len;
+	new.ptr = my_alloc(new.len);
+	if(new.len == name.len) {
+		memcpy(new.ptr, name.ptr, name.len);
+		for(i=0;i<n;i++)
+			if(ent[i].ptr<str.ptr || ent[i].ptr>=str.ptr+str.len)
+				my_free(ent[i].ptr);
+		my_free(ent);
+		return new;
+	}
+
+	memcpy(new.ptr, name.ptr, 6+12*count);
+	p16(new.ptr+4, 6+12*count);
+	p = new.ptr + 6+12*count;
+	for(i=0;i<n;i++) {
+		p = append(p, ent[i].ptr, ent[i].len);
+		if(ent[i].ptr<str.ptr || ent[i].ptr>=str.ptr+str.len)
+			my_free(ent[i].ptr);
+	}
+	my_free(ent);
+
+	{
+		struct buf newstr = {new.ptr + 6+12*count, new.len - 6-12*count};
+		p = new.ptr + 6 + 10;
+		for(i=0;i<count;i++) {
+			struct buf a = {str.ptr+g16(p), g16(p-2)};
+			p16(p, old_bufbuf(newstr, a) - newstr.ptr);
+			p += 12;
+		}
+	}
+	return new;
+}
+
+static unsigned rnd(unsigned n)
+{
+	static u32 x = 1;
+	x = x*1103515245 + 12345;
+	return (x>>8) % n;
+}
+
+/* strings over a small alphabet, many made of pieces of earlier ones */
+static struct buf random_name(int count)
+{
+	static const char *alpha[] = {"ab", "abc", "abcd", "abcdefgh"};
+	const char *al = alpha[rnd(4)];
+	int an = strlen(al), i, k;
+
+	if(!count)
+		count = 1+rnd(120);
+	struct buf t;
+	u8 *p, *s;
+
+	t.ptr = my_alloc(6 + 12*count + 46*count);
+	p = t.ptr + 6 + 12*count;
+	for(i=0; i<count; i++) {
+		u8 *r = t.ptr + 6 + 12*i;
+		int len = 0;
+		s = p;
+		if(p - (t.ptr + 6+12*count) > 0xFFFF-46) { // full, same as another
+			memcpy(r, t.ptr + 6 + 12*rnd(i), 12);
+			continue;
+		} else if(i && rnd(2)) {
+			u8 *q = t.ptr + 6 + 12*rnd(i);
+			int l = g16(q+8), a = rnd(l+1), b = a + rnd(l-a+1);
+			if(b-a > 40)
+				b = a+40;
+			memmove(p, t.ptr + 6+12*count + g16(q+10) + a, b-a);
+			len = b-a;
+			for(k=rnd(7); k; k--)
+				p[len++] = al[rnd(an)];
+		} else
+			for(k=rnd(41); k; k--)
+				p[len++] = al[rnd(an)];
+		memset(r, 0, 12);
+		p16(r+6, i);
+		p16(r+8, len);
+		p16(r+10, s - (t.ptr + 6+12*count));
+		p += len;
+	}
+	memset(t.ptr, 0, 6);
+	p16(t.ptr+2, count);
+	p16(t.ptr+4, 6 + 12*count);
+	t.len = p - t.ptr;
+	return t;
+}
+
+int main(int argc, char *argv[])
+{
+	int n = argc>1 ? atoi(argv[1]) : 1000;
+	int i, bad = 0;
+
+	if(argc > 2)
+		for(i=atoi(argv[2]); i>0; i--)
+			rnd(1);
+
+	for(i=0; i<n; i++) {
+		struct table tab = {0};
+		struct ttf ttf = {0};
+		struct buf name = random_name(0), old;
+
+		tab.tag = g32((u8*)"name");
+		strcpy(tab.name, "name");
+		tab.buf = name;
+		ttf.ntables = 1;
+		ttf.tables = &tab;
+
+		old = old_name(name);
+		optimize_name(&ttf);
+		if(tab.buf.len != old.len || memcmp(tab.buf.ptr, old.ptr, old.len)) {
+			printf("table %d: %u bytes, the pairwise search gives %u\n", i, tab.buf.len, old.len);
+			bad++;
+		}
+		if(tab.buf.ptr != name.ptr)
+			my_free(tab.buf.ptr);
+		my_free(name.ptr);
+		my_free(old.ptr);
+	}
+	printf("%d tables, %d differ\n", n, bad);
+
+	for(i=0; i<n/50; i++) {
+		struct table tab = {0};
+		struct ttf ttf = {0};
+		struct buf name = random_name(NAME_EXACT+1 + rnd(4400));
+		int count = g16(name.ptr+2), k;
+
+		tab.tag = g32((u8*)"name");
+		strcpy(tab.name, "name");
+		tab.buf = name;
+		ttf.ntables = 1;
+		ttf.tables = &tab;
+
+		optimize_name(&ttf);
+		for(k=0; k<count; k++) {
+			u8 *r0 = name.ptr + 6+12*k, *r1 = tab.buf.ptr + 6+12*k;
+			unsigned len = g16(r0+8), o = g16(r1+10);
+			u8 *s1 = tab.buf.ptr + g16(tab.buf.ptr+4) + o;
+			if(len && (s1+len > tab.buf.ptr+tab.buf.len
+			 || memcmp(name.ptr + g16(name.ptr+4) + g16(r0+10), s1, len)))
+				break;
+		}
+		if(k < count || tab.buf.len > name.len) {
+			printf("table of %d strings: string %d lost\n", count, k);
+			bad++;
+		}
+		if(tab.buf.ptr != name.ptr)
+			my_free(tab.buf.ptr);
+		my_free(name.ptr);
+	}
+	printf("%d big tables checked\n", n/50);
+	return !!bad;
+}
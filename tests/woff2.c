@@ -0,0 +1,519 @@
+/*
+ *	Copyright (C) 2017 Jan Bobrowski <jb@wizard.ae.krakow.pl>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+
+/*
+ * WOFF2 round trip: each font is converted to WOFF2 and back to TTF,
+ * and the outlines and horizontal metrics must come back the same.
+ * Every font goes twice, the second time with hmtx moved to the front
+ * of the table directory, so that it is decoded before glyf. Fonts
+ * are random ones, then those given.
+ *
+ *	usage: woff2 [count [font...]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../ttf2woff.h"
+#include "../libttf2woff.h"
+
+static struct ttf2woff *ctx;
+static int transformed; // conversions with glyf and hmtx transformed
+
+static unsigned rnd(unsigned n)
+{
+	static u32 x = 1;
+	x = x*1103515245 + 12345;
+	return (x>>8) % n;
+}
+
+static struct buf table(struct buf font, char *tag)
+{
+	struct buf t = {0};
+	int n = g16(font.ptr+4), i;
+	for(i=0; i<n; i++) {
+		u8 *d = font.ptr + 12 + 16*i;
+		if(g32(d) == g32((u8*)tag)) {
+			t.ptr = font.ptr + g32(d+8);
+			t.len = g32(d+12);
+		}
+	}
+	return t;
+}
+
+/* hmtx entry first */
+static struct buf hmtx_first(struct buf font)
+{
+	struct buf f;
+	int n = g16(font.ptr+4), i;
+	u8 d[16];
+
+	f.ptr = malloc(f.len = font.len);
+	memcpy(f.ptr, font.ptr, font.len);
+	for(i=0; i<n; i++)
+		if(g32(f.ptr + 12 + 16*i) == g32((u8*)"hmtx"))
+			break;
+	if(i < n) {
+		memcpy(d, f.ptr + 12 + 16*i, 16);
+		memmove(f.ptr + 12 + 16, f.ptr + 12, 16*i);
+		memcpy(f.ptr + 12, d, 16);
+	}
+	return f;
+}
+
+/* random font */
+
+struct glyph {
+	u8 b[1024];
+	int len, xmin;
+};
+
+static u8 *put_coord(u8 *p, u8 *f, int d, int bit)
+{
+	if(!d)
+		*f |= 16<<bit;
+	else if(d > -256 && d < 256) {
+		*f |= 2<<bit | (d>0 ? 16<<bit : 0);
+		*p++ = d<0 ? -d : d;
+	} else
+		p = p16(p, d);
+	return p;
+}
+
+static int delta(int v)
+{
+	static const int range[] = {1, 64, 768, 4096, 20000};
+	int r = range[rnd(5)], d;
+	d = rnd(2*r+1) - r;
+	if(v+d < -16000 || v+d > 16000)
+		d = -d;
+	return d;
+}
+
+static void simple_glyph(struct glyph *g)
+{
+	int nc = 1 + rnd(4), np = 0, ni = rnd(3) ? 0 : rnd(20);
+	int x[64], y[64], bb[4], i;
+	u8 f[64], *p, *q;
+
+	p = g->b + 10;
+	for(i=0; i<nc; i++) {
+		np += 1 + rnd(12);
+		p = p16(p, np-1);
+	}
+	p = p16(p, ni);
+	for(i=0; i<ni; i++)
+		*p++ = rnd(256);
+
+	bb[0] = bb[1] = 32767; bb[2] = bb[3] = -32768;
+	for(i=0; i<np; i++) {
+		x[i] = (i ? x[i-1] : 0) + delta(i ? x[i-1] : 0);
+		y[i] = (i ? y[i-1] : 0) + delta(i ? y[i-1] : 0);
+		if(bb[0] > x[i]) bb[0] = x[i];
+		if(bb[1] > y[i]) bb[1] = y[i];
+		if(bb[2] < x[i]) bb[2] = x[i];
+		if(bb[3] < y[i]) bb[3] = y[i];
+	}
+	if(!rnd(10))
+		bb[rnd(4)] += 1 + rnd(50); // to be kept as it is
+
+	q = p;
+	p += np;
+	for(i=0; i<np; i++) {
+		f[i] = rnd(2);
+		p = put_coord(p, &f[i], x[i] - (i ? x[i-1] : 0), 0);
+	}
+	for(i=0; i<np; i++)
+		p = put_coord(p, &f[i], y[i] - (i ? y[i-1] : 0), 1);
+	memcpy(q, f, np);
+
+	p16(g->b, nc);
+	for(i=0; i<4; i++)
+		p16(g->b + 2 + 2*i, bb[i]);
+	g->len = p - g->b;
+	g->xmin = bb[0];
+}
+
+static void composite_glyph(struct glyph *g, int ng)
+{
+	int nc = 1 + rnd(3), instr = rnd(2), i;
+	u8 *p = g->b + 10;
+
+	for(i=0; i<nc; i++) {
+		int f = 2 | rnd(2); // xy values, maybe words
+		f |= (int[]){0, 8, 64, 128}[rnd(4)];
+		if(i < nc-1)
+			f |= 32;
+		if(!i && instr)
+			f |= 256;
+		p = p16(p, f);
+		p = p16(p, rnd(ng));
+		if(f & 1)
+			p = p16(p, rnd(2000) - 1000), p = p16(p, rnd(2000) - 1000);
+		else
+			*p++ = rnd(256), *p++ = rnd(256);
+		if(f & 8)
+			p = p16(p, rnd(0x8000));
+		else if(f & 64)
+			p = p16(p, rnd(0x8000)), p = p16(p, rnd(0x8000));
+		else if(f & 128)
+			for(int k=0; k<4; k++)
+				p = p16(p, rnd(0x8000));
+	}
+	if(instr) {
+		int ni = rnd(20);
+		p = p16(p, ni);
+		for(i=0; i<ni; i++)
+			*p++ = rnd(256);
+	}
+	p16(g->b, 0xFFFF);
+	g->xmin = rnd(2000) - 1000;
+	p16(g->b+2, g->xmin);
+	p16(g->b+4, rnd(2000) - 1000);
+	p16(g->b+6, g->xmin + rnd(2000));
+	p16(g->b+8, rnd(2000));
+	g->len = p - g->b;
+}
+
+static struct buf random_font(void)
+{
+	static const char *tags[] = {"glyf", "head", "hhea", "hmtx", "loca", "maxp"};
+	int ng = 1 + rnd(60), nlhm = 1 + rnd(ng), lf = rnd(2), i;
+	struct glyph *gl = malloc(ng * sizeof *gl);
+	struct buf t[6], f;
+	u8 *p;
+
+	for(i=0; i<ng; i++) {
+		int k = rnd(10);
+		if(!k) // empty
+			gl[i].len = gl[i].xmin = 0;
+		else if(k < 3)
+			composite_glyph(&gl[i], ng);
+		else
+			simple_glyph(&gl[i]);
+	}
+
+	// glyf & loca
+	t[0].len = 0;
+	for(i=0; i<ng; i++)
+		t[0].len += gl[i].len+1 & ~1;
+	t[0].ptr = p = malloc(t[0].len);
+	t[4].ptr = malloc(t[4].len = (lf ? 4 : 2) * (ng+1));
+	for(i=0; i<=ng; i++) {
+		unsigned o = p - t[0].ptr;
+		if(lf)
+			p32(t[4].ptr + 4*i, o);
+		else
+			p16(t[4].ptr + 2*i, o>>1);
+		if(i < ng) {
+			p = append(p, gl[i].b, gl[i].len);
+			if(gl[i].len & 1)
+				*p++ = 0;
+		}
+	}
+
+	t[1].ptr = calloc(1, t[1].len = 54);
+	p32(t[1].ptr, 0x10000);
+	p32(t[1].ptr+12, 0x5F0F3CF5);
+	p16(t[1].ptr+18, 1000);
+	p16(t[1].ptr+50, lf);
+
+	t[2].ptr = calloc(1, t[2].len = 36);
+	p32(t[2].ptr, 0x10000);
+	p16(t[2].ptr+34, nlhm);
+
+	// left side bearings are xMin, but now and then one isn't
+	t[3].ptr = p = malloc(t[3].len = 4*nlhm + 2*(ng-nlhm));
+	for(i=0; i<ng; i++) {
+		int lsb = rnd(8) ? gl[i].xmin : gl[i].xmin + 1;
+		if(i < nlhm)
+			p = p16(p, rnd(2000));
+		p = p16(p, lsb);
+	}
+
+	t[5].ptr = malloc(t[5].len = 6);
+	p32(t[5].ptr, 0x5000);
+	p16(t[5].ptr+4, ng);
+
+	f.len = 12 + 16*6;
+	for(i=0; i<6; i++)
+		f.len += t[i].len+3 & ~3;
+	f.ptr = p = calloc(1, f.len);
+	p32(p, 0x10000);
+	p16(p+4, 6);
+	p16(p+6, 64);
+	p16(p+8, 2);
+	p16(p+10, 32);
+	p += 12 + 16*6;
+	for(i=0; i<6; i++) {
+		u8 *d = f.ptr + 12 + 16*i;
+		p32(d, g32((u8*)tags[i]));
+		p32(d+8, p - f.ptr);
+		p32(d+12, t[i].len);
+		memcpy(p, t[i].ptr, t[i].len);
+		p += t[i].len+3 & ~3;
+		free(t[i].ptr);
+	}
+	free(gl);
+	return f;
+}
+
+/* what a glyph looks like, regardless of how it's encoded */
+
+static int coords(int *v, int np, u8 *f, int bit, u8 **pp, u8 *e)
+{
+	u8 *p = *pp;
+	int i, c = 0;
+	for(i=0; i<np; i++) {
+		if(f[i] & 2<<bit) {
+			if(p >= e) return 0;
+			c += f[i] & 16<<bit ? *p : -*p;
+			p++;
+		} else if(!(f[i] & 16<<bit)) {
+			if(p+2 > e) return 0;
+			c += (s16)g16(p);
+			p += 2;
+		}
+		v[i] = c;
+	}
+	*pp = p;
+	return 1;
+}
+
+/* 0 if the glyph is malformed */
+static int outline(struct buf *o, u8 *p, u8 *e)
+{
+	int nc, np, ni, i;
+	u8 *q, *f;
+	int *x, *y;
+
+	o->ptr = 0;
+	o->len = 0;
+	if(p == e)
+		return 1;
+	if(e - p < 10)
+		return 0;
+	nc = g16(p);
+	if(nc == 0xFFFF) { // components and instructions, as they are
+		int fl, all = 0;
+		q = p + 10;
+		do {
+			if(e - q < 4) return 0;
+			all |= fl = g16(q);
+			q += 4 + (fl&1 ? 4 : 2) + (fl&8 ? 2 : fl&64 ? 4 : fl&128 ? 8 : 0);
+		} while(fl & 32);
+		if(all & 256 && q+2 <= e) // WE_HAVE_INSTRUCTIONS
+			q += 2 + g16(q);
+		if(q > e) return 0;
+		o->ptr = malloc(o->len = q - p);
+		memcpy(o->ptr, p, o->len);
+		return 1;
+	}
+	if(nc & 0x8000 || e - p < 10 + 2*nc + 2)
+		return 0;
+	np = g16(p + 10 + 2*(nc-1)) + 1;
+	ni = g16(p + 10 + 2*nc);
+	q = p + 10 + 2*nc + 2 + ni;
+	if(q > e)
+		return 0;
+
+	f = malloc(np);
+	for(i=0; i<np;) {
+		int v, r = 1;
+		if(q >= e) goto bad;
+		v = *q++;
+		if(v & 8) {
+			if(q >= e) goto bad;
+			r += *q++;
+		}
+		if(i + r > np) goto bad;
+		memset(f+i, v, r);
+		i += r;
+	}
+	x = malloc(2*np * sizeof *x);
+	y = x + np;
+	if(!coords(x, np, f, 0, &q, e) || !coords(y, np, f, 1, &q, e)) {
+		free(x);
+		goto bad;
+	}
+
+	// header, end points and instructions as they are, then the points
+	o->len = 10 + 2*nc + 2 + ni + 9*np;
+	o->ptr = q = malloc(o->len);
+	q = append(q, p, 10 + 2*nc + 2 + ni);
+	for(i=0; i<np; i++) {
+		*q++ = f[i] & 1;
+		q = p32(q, x[i]);
+		q = p32(q, y[i]);
+	}
+	free(x);
+	free(f);
+	return 1;
+bad:
+	free(f);
+	return 0;
+}
+
+static u32 loca(struct buf l, int fmt, int i)
+{
+	return fmt ? g32(l.ptr + 4*i) : g16(l.ptr + 2*i) << 1;
+}
+
+static int same_glyphs(struct buf a, struct buf b)
+{
+	struct buf ga = table(a, "glyf"), gb = table(b, "glyf");
+	struct buf la = table(a, "loca"), lb = table(b, "loca");
+	struct buf ha = table(a, "head"), hb = table(b, "head");
+	int fa, fb, ng, i;
+
+	if(!ga.ptr || !gb.ptr || !la.ptr || !lb.ptr || ha.len < 54 || hb.len < 54)
+		return !ga.ptr && !gb.ptr;
+	fa = g16(ha.ptr+50);
+	fb = g16(hb.ptr+50);
+	ng = la.len / (fa ? 4 : 2) - 1;
+	if(ng != lb.len / (fb ? 4 : 2) - 1)
+		return 0;
+	for(i=0; i<ng; i++) {
+		struct buf oa, ob;
+		int ok;
+		if(!outline(&oa, ga.ptr + loca(la,fa,i), ga.ptr + loca(la,fa,i+1)))
+			continue; // not transformed, nothing to compare
+		if(!outline(&ob, gb.ptr + loca(lb,fb,i), gb.ptr + loca(lb,fb,i+1)))
+			return 0;
+		ok = oa.len == ob.len && (!oa.len || !memcmp(oa.ptr, ob.ptr, oa.len));
+		free(oa.ptr);
+		free(ob.ptr);
+		if(!ok) {
+			printf("  glyph %d differs\n", i);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int same_metrics(struct buf a, struct buf b)
+{
+	struct buf ha = table(a, "hmtx"), hb = table(b, "hmtx");
+	return ha.len == hb.len && !memcmp(ha.ptr, hb.ptr, ha.len);
+}
+
+/* glyf and hmtx transforms used */
+static int both_transformed(struct buf w)
+{
+	u8 *p = w.ptr + 48;
+	int n = g16(w.ptr+12), i, v = 0;
+	for(i=0; i<n; i++) {
+		int f = *p++, t = f>>6;
+		u32 len;
+		if((f&63) == 63)
+			p += 4;
+		do len = *p; while(*p++ & 0x80);
+		if((f&63) == 10 && t == 0) // glyf
+			v |= 1;
+		if((f&63) == 3 && t == 1) // hmtx
+			v |= 2;
+		if((f&63) == 10 && t == 0 || (f&63) == 11 && t == 0 || (f&63) == 3 && t == 1)
+			do len = *p; while(*p++ & 0x80);
+		(void)len;
+	}
+	return v == 3;
+}
+
+static int round_trip(struct buf font, const char *name)
+{
+	struct ttf2woff_options opt;
+	void *w, *t;
+	size_t wl, tl;
+	int v;
+
+	ttf2woff_default_options(&opt);
+	opt.optimize = 0;
+	opt.brotli_quality = 5;
+	opt.format = TTF2WOFF_WOFF2;
+	if((v = ttf2woff_convert(ctx, font.ptr, font.len, &opt, &w, &wl))) {
+		printf("%s: to WOFF2: %s\n", name, ttf2woff_error(ctx));
+		return 0;
+	}
+	opt.format = TTF2WOFF_TTF;
+	if((v = ttf2woff_convert(ctx, w, wl, &opt, &t, &tl))) {
+		printf("%s: from WOFF2: %s\n", name, ttf2woff_error(ctx));
+		ttf2woff_free_output(w);
+		return 0;
+	}
+	{
+		struct buf wb = {w, wl}, tb = {t, tl};
+		transformed += both_transformed(wb);
+		v = 1;
+		if(!same_glyphs(font, tb)) {
+			printf("%s: glyf differs\n", name);
+			v = 0;
+		}
+		if(!same_metrics(font, tb)) {
+			printf("%s: hmtx differs\n", name);
+			v = 0;
+		}
+	}
+	ttf2woff_free_output(w);
+	ttf2woff_free_output(t);
+	return v;
+}
+
+static int check(struct buf font, const char *name)
+{
+	struct buf f = hmtx_first(font);
+	char nm[256];
+	int v = round_trip(font, name);
+	snprintf(nm, sizeof nm, "%s (hmtx first)", name);
+	v &= round_trip(f, nm);
+	free(f.ptr);
+	return v;
+}
+
+int main(int argc, char *argv[])
+{
+	int n = argc>1 ? atoi(argv[1]) : 200;
+	int i, nf = 0, bad = 0;
+
+	ctx = ttf2woff_new(1, 0);
+	if(!ctx)
+		return 1;
+
+	for(i=0; i<n; i++) {
+		struct buf f = random_font();
+		char nm[32];
+		snprintf(nm, sizeof nm, "random font %d", i);
+		bad += !check(f, nm);
+		free(f.ptr);
+		nf++;
+	}
+	for(i=2; i<argc; i++) {
+		struct buf f;
+		FILE *fp = fopen(argv[i], "rb");
+		if(!fp) {
+			perror(argv[i]);
+			return 1;
+		}
+		fseek(fp, 0, SEEK_END);
+		f.len = ftell(fp);
+		rewind(fp);
+		f.ptr = malloc(f.len);
+		if(fread(f.ptr, 1, f.len, fp) != f.len) {
+			perror(argv[i]);
+			return 1;
+		}
+		fclose(fp);
+		bad += !check(f, argv[i]);
+		free(f.ptr);
+		nf++;
+	}
+	ttf2woff_free(ctx);
+
+	printf("%d fonts, both directory orders, %d differ; %d of %d conversions with glyf and hmtx transformed\n",
+	 nf, bad, transformed, 2*nf);
+	return bad || n && !transformed;
+}
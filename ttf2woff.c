@@ -12,48 +12,23 @@
 #include <unistd.h>
 #include <getopt.h>
 #include <stdio.h>
-#include <stdarg.h>
 #include <strings.h>
 #include <errno.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
 #include "ttf2woff.h"
 
 #ifndef O_BINARY
 #define O_BINARY 0
 #endif
 
-struct flags g;
-
-void echo(char *f, ...)
-{
-	FILE *o = g.stdout_used ? stderr : stdout;
-	va_list va;
-	va_start(va, f);
-	vfprintf(o, f, va);
-	va_end(va);
-	fputc('\n',o);
-}
-
-void *my_alloc(size_t sz)
-{
-	void *p = malloc(sz);
-	if(!p) errx(1,"Out of memory");
-	return p;
-}
-
-void *my_free(void *p)
-{
-	free(p);
-	return 0;
-}
-
-void *my_realloc(void *p, size_t sz)
-{
-	p = realloc(p, sz);
-	if(!p) errx(1,"Out of memory");
-	return p;
-}
-
-static struct buf read_file(char *path)
+/*
+ * If mapped is given, a regular file is mapped rather than read.
+ * The mapping is private and writable: readers hand out pointers into
+ * it as table data, and a few tables (head, hhea) get patched in place.
+ */
+struct buf read_file(char *path, int *mapped)
 {
 	struct buf file = {0};
 	int v, fd = 0;
@@ -69,6 +44,19 @@ static struct buf read_file(char *path)
 		if(fstat(fd, &st) < 0)
 			err(1, "fstat");
 		file.len = st.st_size;
+#ifndef WIN32
+		if(mapped && S_ISREG(st.st_mode) && file.len) {
+			void *m = mmap(0, file.len, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+			if(m != MAP_FAILED) {
+				if(fd) close(fd);
+				file.ptr = m;
+				*mapped = 1;
+				return file;
+			}
+		}
+#endif
+		if(mapped)
+			*mapped = 0;
 	}
 
 	if(file.len) {
@@ -101,6 +89,17 @@ static struct buf read_file(char *path)
 	return file;
 }
 
+void release_file(struct buf *file, int mapped)
+{
+#ifndef WIN32
+	if(mapped) {
+		munmap(file->ptr, file->len);
+		return;
+	}
+#endif
+	my_free(file->ptr);
+}
+
 static int open_temporary(char *pt, char **pnm)
 {
 	int l = strlen(pt);
@@ -124,114 +123,6 @@ static int open_temporary(char *pt, char **pnm)
 	return fd;
 }
 
-void alloc_tables(struct ttf *ttf)
-{
-	int sz = ttf->ntables*sizeof *ttf->tables;
-	ttf->tables = my_alloc(sz);
-	memset(ttf->tables, 0, sz);
-}
-
-void name_table(struct table *t) {
-	char *d = t->name;
-	int i;
-	for(i=24; i>=0; i-=8) {
-		char c = t->tag>>i;
-		if(c>' ' && c<127)
-			*d++ = c;
-	}
-	*d = 0;
-}
-
-static u32 calc_csum(u8 *p, size_t n)
-{
-	u32 s=0;
-	if(n) for(;;) {
-		s += p[0]<<24;
-		if(!--n) break;
-		s += p[1]<<16;
-		if(!--n) break;
-		s += p[2]<<8;
-		if(!--n) break;
-		s += p[3];
-		if(!--n) break;
-		p += 4;
-	}
-	return s;
-}
-
-static void recalc_checksums(struct ttf *ttf)
-{
-	u8 h[12];
-	u32 font_csum, off;
-	int i, modified;
-	struct table *head = 0;
-	struct table *DSIG = 0;
-
-	modified = ttf->modified;
-	for(i=0; i<ttf->ntables; i++) {
-		struct table *t = ttf->tab_pos[i];
-		u8 *p = t->buf.ptr;
-		u32 csum;
-
-		if(t->tag == g32("DSIG") && t->buf.len>8)
-			DSIG = t;
-
-		if(t->tag != g32("head"))
-			csum = calc_csum(p, t->buf.len);
-		else {
-			head = t;
-			csum = calc_csum(p, 8);
-			csum += calc_csum(p+12, t->buf.len-12);
-		}
-		modified |= t->modified;
-		if(csum != t->csum) {
-			modified = 1;
-			t->csum = csum;
-			if(!t->modified && !g.silent)
-				echo("Corrected checksum of table %s", t->name);
-		}
-	}
-
-	if(modified && DSIG) {
-remove_signature:
-		if(DSIG->free_buf)
-			my_free(DSIG->buf.ptr);
-		DSIG->buf.len = 8;
-		DSIG->buf.ptr = (u8*)"\0\0\0\1\0\0\0"; // empty DSIG
-		DSIG->free_buf = 0;
-		DSIG->csum = calc_csum(DSIG->buf.ptr, DSIG->buf.len);
-		DSIG = 0;
-		if(g.verbose)
-			echo("Digital signature removed");
-	}
-
-	put_ttf_header(h, ttf);
-	font_csum = calc_csum(h, 12);
-
-	off = 12 + 16*ttf->ntables;
-	for(i=0; i<ttf->ntables; i++) {
-		struct table *t = ttf->tab_pos[i];
-		font_csum += t->tag + t->csum + off + t->buf.len;
-		font_csum += t->csum;
-		off += t->buf.len+3 & ~3;
-	}
-
-	if(!head || head->buf.len<16)
-		errx(1, "No head table");
-
-	{
-		u8 *p = head->buf.ptr + 8;
-		font_csum = 0xB1B0AFBA - font_csum;
-		if(font_csum != g32(p)) {
-			if(DSIG)
-				goto remove_signature;
-			p32(p, font_csum);
-			if(!modified)
-				echo("Corrected checkSumAdjustment");
-		}
-	}
-}
-
 static int usage(FILE *f, int y)
 {
 	if(!y) {
@@ -241,26 +132,47 @@ static int usage(FILE *f, int y)
 		 "\tttf2woff [-v] -i font\n"
 		 "\tttf2woff -h\n");
 	} else {
+		struct compressor **c;
 		fprintf(f,"TTF2WOFF "STR(VERSION)" by Jan Bobrowski\n"
 		 "usage:\n"
-		 " ttf2woff [-v] [-O|-S] [-t type] [-X table]... [-m file] [-p file] input [output]\n"
-		 " ttf2woff -i [-v] [-O|-S] [-X table]... [-m file] [-p file] file\n"
+		 " ttf2woff [-v] [-O|-S] [-j n] [-t type] [-X table]... [-m file] [-p file] input [output]\n"
+		 " ttf2woff -i [-v] [-O|-S] [-j n] [-X table]... [-m file] [-p file] file\n"
+		 " ttf2woff -b [-i] [options] [-f list] input output...\n"
 		 " ttf2woff -l input\n"
+		 " ttf2woff -s socket [-j n] [-k n] [-C dir] [-T]\n"
+		 " ttf2woff -R n [options] dir\n"
 		 "  -i      in place modification\n"
 		 "  -O      optimize (default unless signed)\n"
 		 "  -S      don't optimize\n"
-		 "  -t fmt  output format: woff, ttf\n"
-		 "  -u num  font number in collection (TTC), 0-based\n"
+		 "  -t fmt  output format: woff, woff2, ttf\n"
+		 "  -Q q    WOFF2 compression: 0-11, fast or small (default)\n"
+		 "  -c name WOFF compressor (default zopfli), see below\n"
+		 "  -I n    zopfli iterations (default 15, 0: zlib level 9)\n"
+		 "  -L n    libdeflate level: 1-12 (default 12)\n"
+		 "  -M MiB  zopfli match cache limit per block (default none)\n"
+		 "  -D sec  WOFF compression time budget per file\n"
+		 "  -y how  verify zopfli output: off, inline, background (default)\n"
+		 "  -u num  font number in collection (TTC), 0-based, or `all'\n"
 		 "  -m xml  metadata\n"
 		 "  -p priv private data\n"
 		 "  -X tag  remove table\n"
+		 "  -j n    use n threads (0: one per CPU)\n"
+		 "  -b      batch: convert input/output pairs (or files, with -i)\n"
+		 "  -f list batch: read pairs from file, one per line\n"
+		 "  -C dir  cache compressed tables in dir\n"
+		 "  -s sock serve conversions on a Unix socket (one worker per thread)\n"
+		 "  -k n    serve: at most n connections waiting for a worker\n"
+		 "  -R n    benchmark fonts in dir, n times over; JSON report\n"
 		 "  -l      list tables\n"
+		 "  -T      print timings and counters as JSON on stderr\n"
 		 "  -v      be verbose\n"
 //		 "  -q      be silent\n"
 		 "Use `-' to indicate standard input/output.\n"
 		 "Skip output for dry run.\n"
-		 "Compressor: %s.\n",
-		 copression_by);
+		 "Compressors:");
+		for(c=compressors; *c; c++)
+			fprintf(f, " %s,", (*c)->name);
+		fprintf(f, " best.\n");
 	}
 	return 1;
 }
@@ -269,54 +181,415 @@ static int type_by_name(char *s)
 {
 	if(strcasecmp(s,"TTF")==0 || strcasecmp(s,"OTF")==0) return fmt_TTF;
 	if(strcasecmp(s,"WOFF")==0) return fmt_WOFF;
+	if(strcasecmp(s,"WOFF2")==0) return fmt_WOFF2;
 	return fmt_UNKNOWN;
 }
 
-static int cmp_tab_pos(const void *a, const void *b) {
-	return (*(struct table**)a)->pos - (*(struct table**)b)->pos;
+static struct options opt;
+static int fontn;
+
+struct input {
+	char *name;
+	struct buf file;
+	int type, mapped;
+};
+
+/* oname: 0 for dry run, "-" for stdout */
+static int put_font(struct input *in, struct ttf *ttf, char *oname, struct options *o)
+{
+	struct output output = {0};
+	int i, v;
+	int dryrun = !oname && !g.inplace;
+
+	if(g.listonly) {
+		unsigned size;
+		remove_tables(ttf, &o->xtab);
+		size = 12 + 16*ttf->ntables;
+		for(i=0; i<ttf->ntables; i++) {
+			struct table *t = &ttf->tables[i];
+			size += t->buf.len;
+			echo("%-4s %6u", t->name, t->buf.len);
+		}
+		echo("%-4s %6u", "", size);
+		return 0;
+	}
+
+	make_font(&output, ttf, o);
+
+	if(g.verbose || (dryrun && !g.silent))
+		echo("input: %s %u bytes, output: %s %u bytes (%.1f%%)",
+		 fmt_name[in->type], in->file.len, fmt_name[o->otype], output.len, 100.*output.len/in->file.len);
+
+	if(dryrun)
+		goto done;
+
+	if(g.inplace && !ttf->modified && !ttf->modified_meta) {
+		if(output.len >= in->file.len) {
+			if(g.verbose)
+				echo("Not modified");
+			goto done;
+		}
+	}
+
+	{
+		struct timing t;
+		int fd = 1;
+
+		stat_start(&t);
+		if(g.inplace)
+			fd = open_temporary(in->name, &oname);
+		else if(oname[0]!='-' || oname[1]) {
+			fd = open(oname, O_WRONLY|O_TRUNC|O_CREAT|O_BINARY, 0666);
+			if(fd<0) err(1, "%s", oname);
+		}
+
+		out_write(fd, &output);
+
+		if(fd!=1) close(fd);
+		stat_stop(&t, "write", 0, 0);
+	}
+
+	if(g.inplace) {
+#ifdef WIN32
+		unlink(in->name);
+#endif
+		v = rename(oname, in->name);
+		if(v<0) {
+			warn("Rename %s to %s", oname, in->name);
+			unlink(oname);
+			out_free(&output);
+			return 1;
+		}
+		my_free(oname);
+	}
+
+done:
+	out_free(&output);
+	return 0;
+}
+
+/* "font.woff" -> "font-N.woff", or printf-style if there is a %d */
+static char *face_name(char *oname, int n)
+{
+	int l = strlen(oname);
+	char *nm = my_alloc(l + 16);
+	char *p = strstr(oname, "%d");
+	if(p && !strchr(p+2, '%'))
+		sprintf(nm, oname, n);
+	else {
+		char *sl = strrchr(oname, '/');
+		p = strrchr(oname, '.');
+		if(!p || (sl && p < sl))
+			p = oname + l;
+		sprintf(nm, "%.*s-%d%s", (int)(p-oname), oname, n, p);
+	}
+	return nm;
+}
+
+/* oname: 0 for dry run, "-" for stdout */
+static int convert(char *iname, char *oname)
+{
+	struct ttf *faces;
+	struct input in = {iname};
+	struct options o = opt;
+	int i, v, nfaces, otype, all = 0;
+
+	if(o.budget)
+		o.deadline = clock_now() + o.budget;
+	otype = opt.otype;
+	if(oname && oname[0]=='-' && !oname[1])
+		g.stdout_used = 1;
+	else if(oname && otype==fmt_UNKNOWN) {
+		char *p = strrchr(oname, '.');
+		if(p)
+			otype = type_by_name(p+1);
+	}
+#ifndef WRITE_WOFF2
+	if(otype==fmt_WOFF2)
+		errx(1, "WOFF2 output is not supported");
+#endif
+
+	in.file = read_file(iname, &in.mapped);
+	in.type = font_type(in.file.ptr, in.file.len);
+
+	if(g.inplace && in.type==fmt_TTC)
+		errx(1, "Collection optimization not supported");
+	if(g.inplace && in.type==fmt_WOFF2)
+		errx(1, "WOFF2 optimization not supported");
+
+	nfaces = read_font(&faces, in.file.ptr, in.file.len, fontn);
+	if(in.type==fmt_TTC && fontn < 0) {
+		if(g.stdout_used && !g.listonly)
+			errx(1, "Can't write %d fonts to standard output", nfaces);
+		all = 1;
+	}
+
+	if(g.inplace)
+		otype = in.type;
+	if(otype==fmt_UNKNOWN)
+		otype = fmt_WOFF;
+	o.otype = otype;
+
+	v = 0;
+	if(!all)
+		v = put_font(&in, faces, oname, &o);
+	else for(i=0; i<nfaces; i++) {
+		char *nm = oname ? face_name(oname, i) : 0;
+		if(g.verbose || g.listonly || (!oname && !g.silent))
+			echo("Font #%d:", i);
+		v |= put_font(&in, &faces[i], nm, &o);
+		my_free(nm);
+	}
+
+	for(i=nfaces; --i>=0;)
+		free_ttf(&faces[i]);
+	my_free(faces);
+	release_file(&in.file, in.mapped);
+	return v;
+}
+
+/* batch mode */
+
+struct job {
+	char *iname, *oname;
+	off_t size;
+	int status;
+};
+
+static void batch_job(void *arg, int i)
+{
+	struct job *j = (struct job*)arg + i;
+	struct trap tr, *prev = trap;
+	struct arena *prev_arena = arena;
+	struct stats *prev_stats = stats;
+
+	tr.name = j->iname;
+	tr.msg = 0;
+	trap = &tr;
+	arena = arena_new();
+	stats = g.stats ? stats_new() : 0;
+	if(!setjmp(tr.jb))
+		j->status = convert(j->iname, j->oname);
+	else
+		j->status = tr.status;
+	trap = prev;
+	stats_report(stats, j->iname, j->status);
+	stats = prev_stats;
+	arena_free(arena);
+	arena = prev_arena;
+}
+
+static int cmp_job_size(const void *a, const void *b) {
+	off_t d = ((struct job*)b)->size - ((struct job*)a)->size;
+	return d<0 ? -1 : d>0;
+}
+
+static void add_job(struct job **jobs, int *n, char *iname, char *oname)
+{
+	struct job *j;
+	struct stat st;
+
+	if(oname && oname[0]=='-' && !oname[1])
+		errx(1, "Can't write to standard output in batch mode");
+
+	if(!(*n & 15))
+		*jobs = my_realloc(*jobs, (*n+16) * sizeof **jobs);
+	j = &(*jobs)[(*n)++];
+	j->iname = iname;
+	j->oname = oname;
+	j->size = stat(iname, &st) ? 0 : st.st_size;
+	j->status = 0;
+}
+
+static char *next_field(char **pp, int sep)
+{
+	char *p = *pp, *f;
+	while(*p==' ' || *p=='\t') p++;
+	if(!*p)
+		return 0;
+	f = p;
+	if(sep == ' ')
+		p += strcspn(p, " \t");
+	else
+		p += strcspn(p, "\t");
+	if(*p) *p++ = 0;
+	*pp = p;
+	return f;
+}
+
+/*
+ * One "input output" pair per line, tab separated (or by blanks if
+ * there is no tab in the line). Output may be omitted for a dry run.
+ */
+static void read_list(struct job **jobs, int *n, char *list)
+{
+	struct buf b = read_file(list, 0);
+	char *p, *e;
+
+	b.ptr = my_realloc(b.ptr, b.len+1);
+	b.ptr[b.len] = 0;
+
+	for(p=(char*)b.ptr; *p; p=e) {
+		char *iname, *oname;
+		int l;
+
+		e = p + strcspn(p, "\n");
+		if(*e) *e++ = 0;
+		l = strlen(p);
+		while(l && (p[l-1]=='\r' || p[l-1]==' ' || p[l-1]=='\t'))
+			p[--l] = 0;
+
+		iname = next_field(&p, strchr(p,'\t') ? '\t' : ' ');
+		if(!iname || iname[0]=='#')
+			continue;
+		oname = g.inplace ? 0 : next_field(&p, '\t');
+		add_job(jobs, n, iname, oname);
+	}
+}
+
+static int batch(char **args, int nargs, char *list)
+{
+	struct job *jobs = 0;
+	int n = 0, status = 0, failed = 0;
+	int i;
+
+	for(i=0; i<nargs; i++) {
+		char *iname = args[i], *oname = 0;
+		if(!g.inplace) {
+			if(++i == nargs)
+				errx(1, "No output for %s", iname);
+			oname = args[i];
+		}
+		add_job(&jobs, &n, iname, oname);
+	}
+	if(list)
+		read_list(&jobs, &n, list);
+
+	// biggest first, so that the tail is made of short jobs
+	qsort(jobs, n, sizeof *jobs, cmp_job_size);
+	pool_run(batch_job, jobs, n);
+
+	for(i=0; i<n; i++)
+		if(jobs[i].status) {
+			failed++;
+			if(status < jobs[i].status)
+				status = jobs[i].status;
+		}
+	if(failed && !g.silent)
+		warnx("%d of %d conversions failed", failed, n);
+	my_free(jobs);
+	return status;
 }
 
 int main(int argc, char *argv[])
 {
-	struct ttf ttf = {0};
-	char *iname, *itype_name, *oname, *otype_name, *mname=0, *pname=0;
-	struct buf input, output;
-	struct buf xtab = {0};
-	int i, v, itype, fontn;
-
-	g.otype = fmt_UNKNOWN;
-	g.dryrun = 1; // no output
-	g.mayoptim = 1;
+	char *iname, *oname, *list=0, *sock=0, *e;
+	int v, threads = -1, depth = 16, reps = 0;
+
+	opt.otype = fmt_UNKNOWN;
+	opt.mayoptim = 1;
+	opt.brotli_q = 11;
+	opt.comp = &comp_zopfli;
+	opt.zopfli_iter = 15;
+	opt.verify = VERIFY_BACKGROUND;
 	fontn = 0;
 
-	for(;;) switch(getopt(argc, argv, "vqt:u:SOX:lm:p:ihV")) {
+	for(;;) switch(getopt(argc, argv, "vqt:u:SOX:lm:p:ij:bf:C:Q:c:I:L:M:D:y:R:s:k:ThV")) {
 	case 'v': g.verbose = 1; break;
 	case 'q': g.silent = 1; break;
 	case 'l': g.listonly = 1; break;
+	case 'T': g.stats = 1; break;
 	case 'i': g.inplace = 1; break;
 	case 't':
 		v = type_by_name(optarg);
 		if(v==fmt_UNKNOWN)
 			errx(1, "Unsupported font type: %s", optarg);
-		g.otype = v;
+		opt.otype = v;
 		break;
 	case 'u':
-		fontn = atoi(optarg);
+		fontn = strcmp(optarg,"all")==0 ? -1 : atoi(optarg);
 		break;
 	case 'S':
-		g.mayoptim = g.optimize = 0;
+		opt.mayoptim = opt.optimize = 0;
 		break;
 	case 'O':
-		g.mayoptim = g.optimize = 1;
+		opt.mayoptim = opt.optimize = 1;
 		break;
 	case 'X':
 		v = strlen(optarg) + 1;
-		xtab.ptr = my_realloc(xtab.ptr, xtab.len+v);
-		strcpy(xtab.ptr+xtab.len, optarg);
-		xtab.len += v;
+		opt.xtab.ptr = my_realloc(opt.xtab.ptr, opt.xtab.len+v);
+		strcpy((char*)opt.xtab.ptr+opt.xtab.len, optarg);
+		opt.xtab.len += v;
 		break;
-	case 'm': mname = optarg; break;
-	case 'p': pname = optarg; break;
+	case 'm': opt.meta = read_file(optarg, 0); break;
+	case 'p': opt.priv = read_file(optarg, 0); break;
+	case 'j':
+		threads = atoi(optarg);
+		pool_init(threads);
+		break;
+	case 'C':
+		zcache_init(optarg);
+		break;
+	case 'c':
+		opt.best = strcmp(optarg,"best")==0;
+		opt.comp = opt.best ? &comp_zopfli : find_compressor(optarg);
+		if(!opt.comp)
+			errx(1, "Unknown compressor: %s", optarg);
+		break;
+	case 'I':
+		v = strtol(optarg, &e, 10);
+		if(*e || v<0 || v>1000)
+			errx(1, "Bad number of iterations: %s", optarg);
+		opt.zopfli_iter = v;
+		break;
+	case 'L':
+		v = strtol(optarg, &e, 10);
+		if(*e || v<1 || v>12)
+			errx(1, "Bad compression level: %s", optarg);
+		opt.level = v;
+		break;
+	case 'M':
+		v = strtol(optarg, &e, 10);
+		if(*e || v<0 || v>4095)
+			errx(1, "Bad cache size: %s", optarg);
+		opt.zopfli_cache = v;
+		break;
+	case 'D':
+		opt.budget = strtod(optarg, &e);
+		if(*e || opt.budget<0)
+			errx(1, "Bad time budget: %s", optarg);
+		break;
+	case 'y':
+		if(strcmp(optarg,"off")==0)
+			opt.verify = VERIFY_OFF;
+		else if(strcmp(optarg,"inline")==0)
+			opt.verify = VERIFY_INLINE;
+		else if(strcmp(optarg,"background")==0)
+			opt.verify = VERIFY_BACKGROUND;
+		else
+			errx(1, "Bad verification mode: %s", optarg);
+		break;
+	case 'Q':
+		if(strcmp(optarg,"fast")==0)
+			v = 4;
+		else if(strcmp(optarg,"small")==0)
+			v = 11;
+		else {
+			v = strtol(optarg, &e, 10);
+			if(*e || v<0 || v>11)
+				errx(1, "Bad compression level: %s", optarg);
+		}
+		opt.brotli_q = v;
+		break;
+	case 'R':
+		reps = strtol(optarg, &e, 10);
+		if(*e || reps<1)
+			errx(1, "Bad number of repetitions: %s", optarg);
+		break;
+	case 's': sock = optarg; break;
+	case 'k': depth = atoi(optarg); break;
+	case 'f': list = optarg; /* fall through */
+	case 'b': g.batch = 1; break;
 	case '?':
 		if(optopt!='?')
 			break;
@@ -326,6 +599,18 @@ int main(int argc, char *argv[])
 	}
 gotopt:
 
+	if(sock)
+		return serve(sock, pool_init(threads<0 ? 0 : threads), depth);
+
+	if(g.batch)
+		return batch(argv+optind, argc-optind, list);
+
+	if(reps) {
+		if(optind+1 != argc)
+			return usage(stderr,0);
+		return bench(argv[optind], reps, &opt);
+	}
+
 	if(optind==argc)
 		return usage(stderr,0);
 
@@ -335,194 +620,20 @@ gotopt:
 	if(g.inplace) {
 		if(iname[0]=='-' && !iname[1])
 			errx(1, "-i is not compatible with -");
-		g.dryrun = 0;
 		if(optind < argc)
 			warnx("Too many args");
 	}
 
 	if(optind < argc) {
-		g.dryrun = 0;
 		oname = argv[optind++];
 		if(optind < argc)
 			warnx("Too many args");
-		if(oname[0]=='-' && !oname[1]) {
-			oname = 0;
-			g.stdout_used = 1;
-		} else if(g.otype==fmt_UNKNOWN) {
-			char *p = strrchr(oname, '.');
-			if(p)
-				g.otype = type_by_name(p+1);
-		}
-	}
-
-	input = read_file(iname);
-
-	if(input.len < 28)
-		errx(1,"File too short");
-
-	itype = fmt_UNKNOWN;
-	if(g32(input.ptr) == g32("wOFF")) {
-		read_woff(&ttf, input.ptr, input.len);
-		itype_name = "WOFF";
-		itype = fmt_WOFF;
-	} else if(g32(input.ptr) == g32("ttcf")) {
-		if(g.inplace)
-			errx(1, "Collection optimization not supported");
-		read_ttc(&ttf, input.ptr, input.len, fontn);
-		itype_name = "TTC";
-	} else if(g32(input.ptr) == g32("wOF2")) {
-#ifndef READ_WOFF2
-		errx(1, "WOFF2 is not supported");
-#else
-		if(g.inplace)
-			errx(1, "WOFF2 optimization not supported");
-		read_woff2(&ttf, input.ptr, input.len);
-		itype_name = "WOFF2";
-		itype = fmt_WOFF2;
-#endif
-	} else {
-		read_ttf(&ttf, input.ptr, input.len, 0);
-		itype_name = "TTF";
-		itype = fmt_TTF;
-	}
-
-	if(g.inplace)
-		g.otype = itype;
-
-	if(g.otype==fmt_UNKNOWN || g.otype==fmt_WOFF) {
-		g.otype = fmt_WOFF;
-		if(mname)
-			ttf.woff_meta = read_file(mname);
-		if(pname)
-			ttf.woff_priv = read_file(pname);
 	}
 
-	// all read
-
-	if(xtab.len) {
-		char *p=xtab.ptr, *e=p+xtab.len;
-		for(; p<e; p=strchr(p,0)+1) {
-			struct table *t;
-			struct buf *b;
-			if(strcmp(p,"metadata")==0) {
-				b = &ttf.woff_meta;
-rm_meta:
-				if(b->len) {
-					b->len = 0;
-					ttf.modified_meta = 1;
-				}
-				continue;
-			}
-			if(strcmp(p,"private")==0) {
-				b = &ttf.woff_priv;
-				goto rm_meta;
-			}
-			for(i=0; i<ttf.ntables; i++) {
-				t = &ttf.tables[i];
-				if(strcmp(t->name, p)==0)
-					goto rm_tab;
-			}
-			echo("Table %s not found", p);
-			if(0) {
-rm_tab:
-				memmove(t, t+1, (char*)(ttf.tables+ttf.ntables) - (char*)(t+1));
-				ttf.ntables--;
-				ttf.modified = 1;
-				if(g.verbose)
-					echo("Table %s removed", p);
-			}
-		}
-		my_free(xtab.ptr);
-	}
-
-	if(g.listonly) {
-		unsigned size = 12 + 16*ttf.ntables;
-		for(i=0; i<ttf.ntables; i++) {
-			struct table *t = &ttf.tables[i];
-			size += t->buf.len;
-			echo("%-4s %6u", t->name, t->buf.len);
-		}
-		echo("%-4s %6u", "", size);
-		return 0;
-	}
-
-	ttf.tab_pos = my_alloc(ttf.ntables * sizeof *ttf.tab_pos);
-	for(i=0; i<ttf.ntables; i++)
-		ttf.tab_pos[i] = &ttf.tables[i];
-	qsort(ttf.tab_pos, ttf.ntables, sizeof *ttf.tab_pos, cmp_tab_pos);
-
-	if(!ttf.modified) {
-		struct table *t = find_table(&ttf, "DSIG");
-		if(t && t->buf.len>8)
-			g.mayoptim = g.optimize;
-	}
-
-	if(g.mayoptim)
-		optimize(&ttf);
-
-	recalc_checksums(&ttf);
-
-	switch(g.otype) {
-	case fmt_TTF:
-		gen_ttf(&output, &ttf);
-		otype_name = "TTF";
-		break;
-	case fmt_WOFF:
-		gen_woff(&output, &ttf);
-		otype_name = "WOFF";
-		break;
-	}
-
-	if(g.verbose || (g.dryrun && !g.silent))
-		echo("input: %s %u bytes, output: %s %u bytes (%.1f%%)",
-		 itype_name, input.len, otype_name, output.len, 100.*output.len/input.len);
-
-	if(g.dryrun)
-		return 0;
-
-	if(g.inplace && !ttf.modified && !ttf.modified_meta) {
-		if(output.len >= input.len) {
-			if(g.verbose)
-				echo("Not modified");
-			return 0;
-		}
-	}
-
-	{
-		u8 *p=output.ptr, *e=p+output.len;
-		int fd = 1;
-
-		if(g.inplace)
-			fd = open_temporary(iname, &oname);
-		else if(oname) {
-			fd = open(oname, O_WRONLY|O_TRUNC|O_CREAT|O_BINARY, 0666);
-			if(fd<0) err(1, "%s", oname);
-		}
-
-		do {
-			v = write(fd, p, e-p);
-			if(v<=0) {
-				if(v) err(1, "write");
-				errx(1, "Short write");
-			}
-			p += v;
-		} while(p < e);
-
-		close(fd);
-	}
-
-	if(g.inplace) {
-#ifdef WIN32
-		unlink(iname);
-#endif
-		v = rename(oname, iname);
-		if(v<0) {
-			warn("Rename %s to %s", oname, iname);
-			unlink(oname);
-			return 1;
-		}
-//		free(oname);
-	}
-
-	return 0;
+	arena = arena_new();
+	if(g.stats)
+		stats = stats_new();
+	v = convert(iname, oname);
+	stats_report(stats, iname, v);
+	return v;
 }
@@ -14,23 +14,49 @@ void warn(char*,...);
 void warnx(char*,...);
 #endif
 
+#include <errno.h>
+#include <setjmp.h>
+
+/*
+ * While a trap is set, err() and errx() unwind to it instead of
+ * terminating the process. Used to isolate jobs from each other.
+ * With msg set, the error message is stored there rather than printed
+ * and echo() is quiet; that's how the library runs.
+ */
+struct trap {
+	jmp_buf jb;
+	int status;
+	char *name;
+	char *msg; // TRAP_MSG bytes
+};
+
+#define TRAP_MSG 256
+
+extern __thread struct trap *trap;
+void fail(int status, int e, char *fmt, ...) __attribute__((noreturn));
+void unwind(int status) __attribute__((noreturn));
+
+#define err(S,...) fail(S, errno, __VA_ARGS__)
+#define errx(S,...) fail(S, -1, __VA_ARGS__)
+
 enum {
 	fmt_UNKNOWN=0,
 	fmt_TTF,
 	fmt_WOFF,
-	fmt_WOFF2
+	fmt_WOFF2,
+	fmt_TTC // input only
 };
 
+extern char *fmt_name[];
+
 extern struct flags {
-	unsigned otype:8;
 	unsigned stdout_used:1;
 	unsigned verbose:1;
 	unsigned silent:1;
-	unsigned mayoptim:1;
-	unsigned optimize:1;
-	unsigned dryrun:1;
 	unsigned inplace:1;
+	unsigned batch:1;
 	unsigned listonly:1;
+	unsigned stats:1;
 } g;
 
 void echo(char *, ...);
@@ -56,6 +82,7 @@ struct table {
 	u32 tag;
 	unsigned modified:1;
 	unsigned free_buf:1;
+	unsigned zshared:1; // zbuf belongs to another face
 	struct buf buf;
 	u32 csum;
 	u32 pos;
@@ -73,26 +100,133 @@ struct ttf {
 	struct buf woff_meta, woff_priv;
 
 	struct buf aux_buf;
+
+	struct ttf *prev_face; // in the same collection
+	struct memo *memo; // optimizations done, for later faces
 };
 
+struct output {
+	struct piece {
+		struct buf buf;
+		int own;
+	} *piece;
+	int n;
+	unsigned len;
+};
+
+/* settings of a single conversion */
+struct options {
+	int otype;
+	unsigned mayoptim:1; // optimize unless signed
+	unsigned optimize:1; // even if signed
+	unsigned brotli_q:4;
+	unsigned best:1; // zlib first, comp only where it may gain enough
+	struct compressor *comp; // for WOFF
+	int zopfli_iter; // 0: zlib level 9
+	int zopfli_cache; // MiB of match cache per zopfli block, 0: no limit
+	int level; // libdeflate, 0: default
+	int verify; // VERIFY_*
+	double budget; // seconds per file, for WOFF compression
+	double deadline; // clock_now() when the budget runs out, if any
+	struct buf xtab; // tables to remove, NUL terminated names
+	struct buf meta, priv; // WOFF metadata & private data, if given
+};
+
+void out_add(struct output *o, u8 *p, unsigned n, int own);
+void out_pad(struct output *o);
+void out_free(struct output *o);
+void out_write(int fd, struct output *o);
+
 void alloc_tables(struct ttf *ttf);
 void name_table(struct table *t);
 u8 *put_ttf_header(u8 buf[12], struct ttf *ttf);
 struct table *find_table(struct ttf *ttf, char tag[4]);
 void optimize(struct ttf *ttf);
+void forget(struct ttf *ttf);
 
 void read_ttf(struct ttf *ttf, u8 *data, size_t length, unsigned offset);
 void read_ttc(struct ttf *ttf, u8 *data, size_t length, int fontn);
+int read_ttc_all(struct ttf **faces, u8 *data, size_t length);
 void read_woff(struct ttf *ttf, u8 *data, size_t length);
 void read_woff2(struct ttf *ttf, u8 *data, size_t length);
-void gen_woff(struct buf *out, struct ttf *ttf);
-void gen_ttf(struct buf *out, struct ttf *ttf);
+void gen_woff(struct output *out, struct ttf *ttf, struct options *opt);
+void gen_ttf(struct output *out, struct ttf *ttf);
+void gen_woff2(struct output *out, struct ttf *ttf, int quality);
+void prepare_woff2(struct ttf *ttf);
+extern char woff2_known_tags[];
+
+int font_type(u8 *data, size_t len);
+int read_font(struct ttf **faces, u8 *data, size_t len, int fontn);
+void remove_tables(struct ttf *ttf, struct buf *xtab);
+void make_font(struct output *out, struct ttf *ttf, struct options *opt);
+/* make_font() step by step */
+int setup_font(struct ttf *ttf, struct options *opt);
+void recalc_checksums(struct ttf *ttf);
+void gen_font(struct output *out, struct ttf *ttf, struct options *opt);
+void free_ttf(struct ttf *ttf);
 
 #define ERR_FONT errx(2, "Bad font [%s:%d]",__FILE__,__LINE__)
 #define ERR_TRUNCATED errx(2, "File truncated [%s:%d]",__FILE__,__LINE__)
 
-int zlib_compress(struct buf *out, struct buf *inp);
-extern char *copression_by;
+enum {VERIFY_OFF, VERIFY_INLINE, VERIFY_BACKGROUND};
+
+/* how hard a compressor tries */
+struct effort {
+	struct compressor *comp;
+	int iterations; // zopfli; 0 for zlib level 9
+	double until; // clock_now() to stop iterating at, if not 0
+	int verify; // zopfli output
+	int stopped; // set if it did
+	int unverified; // set if the output is to be verified in the background
+	int cache_mb; // zopfli match cache limit, 0: none; doesn't affect the output
+	int level; // libdeflate, 1-12; 0: LIBDEFLATE_LEVEL
+};
+
+#define LIBDEFLATE_LEVEL 12 // close to zopfli, in a small fraction of its time
+
+/* a deflate backend, making zlib streams */
+struct compressor {
+	char *name;
+	int (*compress)(struct buf *out, struct buf *inp, struct effort *e); // 0 unless smaller
+	char *(*tag)(char buf[16], struct effort *e); // identifies settings affecting the output
+};
+
+extern struct compressor comp_zlib, comp_zopfli, comp_libdeflate;
+extern struct compressor *compressors[]; // NULL terminated
+struct compressor *find_compressor(char *name);
+
+void zcache_init(char *dir);
+int zcache_compress(struct buf *out, struct buf *inp, struct effort *e);
+
+double clock_now(void);
+
+struct checks;
+int zlib_verify(struct buf *z, struct buf *orig);
+struct checks *verify_start(void);
+void verify_later(struct checks *s, struct buf *z, struct buf *orig);
+int verify_finish(struct checks *s);
+
+u32 calc_csum(u8 *p, size_t n);
+
+struct sha256 {
+	u32 h[8];
+	unsigned long long len;
+	u8 blk[64];
+};
+
+void sha256_init(struct sha256 *s);
+void sha256_update(struct sha256 *s, const void *data, size_t n);
+void sha256_final(struct sha256 *s, u8 md[32]);
+
+int pool_init(int nthreads);
+int pool_size(void);
+void pool_run(void (*fn)(void *arg, int i), void *arg, int n);
+
+/* command line */
+struct buf read_file(char *path, int *mapped);
+void release_file(struct buf *file, int mapped);
+int serve(char *path, int nworkers, int depth);
+int bench(char *dir, int reps, struct options *opt);
 
 #define _STR(X) #X
 #define STR(X) _STR(X)
@@ -103,6 +237,23 @@ void *my_alloc(size_t sz);
 void *my_free(void *p);
 void *my_realloc(void *p, size_t sz);
 
+struct arena;
+extern __thread struct arena *arena; // my_alloc() takes from it, if set
+struct arena *arena_new(void);
+void arena_free(struct arena *a);
+
+/* instrumentation, see stats.c */
+struct timing {
+	double wall, cpu;
+};
+struct stats;
+extern __thread struct stats *stats; // steps count to it, if set
+struct stats *stats_new(void);
+void stats_report(struct stats *s, char *name, int status);
+void stat_alloc(size_t n);
+void stat_start(struct timing *t);
+void stat_stop(struct timing *t, char *what, char *table, char *by);
+
 struct xbuf {
 	u8 *p;
 	struct buf buf;
@@ -0,0 +1,141 @@
+/*
+ *	Copyright (C) 2013-2017 Jan Bobrowski <jb@wizard.ae.krakow.pl>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <zlib.h>
+#include "ttf2woff.h"
+
+/*
+ * Checks that compressed data inflates back to the original. In the
+ * background, checks go to a thread of their own and run while the
+ * next tables get compressed; verify_finish() waits for those of a set.
+ * The checked buffers must stay put until then.
+ */
+
+static int inflates_to(struct buf *z, struct buf *orig, u8 *tmp)
+{
+	uLongf len = orig->len;
+	return uncompress(tmp, &len, z->ptr, z->len) == Z_OK
+	 && len == orig->len && !memcmp(tmp, orig->ptr, len);
+}
+
+int zlib_verify(struct buf *z, struct buf *orig)
+{
+	u8 *tmp = my_alloc(orig->len);
+	int v = inflates_to(z, orig, tmp);
+	my_free(tmp);
+	return v;
+}
+
+struct checks {
+	int pending, failed;
+};
+
+struct check {
+	struct buf z, orig;
+	struct checks *set;
+	struct check *next;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static struct check *queue, **queue_tail = &queue;
+static int running;
+
+static void *checker(void *unused)
+{
+	u8 *tmp = 0;
+	size_t size = 0;
+
+	pthread_mutex_lock(&lock);
+	for(;;) {
+		struct check *c;
+		int ok;
+
+		while(!queue)
+			pthread_cond_wait(&work, &lock);
+		c = queue;
+		queue = c->next;
+		if(!queue)
+			queue_tail = &queue;
+		pthread_mutex_unlock(&lock);
+
+		// one buffer, reused
+		if(size < c->orig.len) {
+			free(tmp);
+			size = c->orig.len;
+			tmp = malloc(size);
+			if(!tmp)
+				size = 0;
+		}
+		ok = tmp && inflates_to(&c->z, &c->orig, tmp);
+
+		pthread_mutex_lock(&lock);
+		if(!ok)
+			c->set->failed = 1;
+		if(!--c->set->pending)
+			pthread_cond_broadcast(&done);
+		free(c);
+	}
+	return 0;
+}
+
+struct checks *verify_start(void)
+{
+	struct checks *s = malloc(sizeof *s);
+	if(!s) errx(1,"Out of memory");
+	s->pending = s->failed = 0;
+	return s;
+}
+
+void verify_later(struct checks *s, struct buf *z, struct buf *orig)
+{
+	struct check *c = malloc(sizeof *c);
+	if(!c) errx(1,"Out of memory");
+	c->z = *z;
+	c->orig = *orig;
+	c->set = s;
+	c->next = 0;
+
+	pthread_mutex_lock(&lock);
+	if(!running) {
+		pthread_t th;
+		if(pthread_create(&th, 0, checker, 0)) {
+			pthread_mutex_unlock(&lock);
+			free(c);
+			if(!zlib_verify(z, orig)) {
+				pthread_mutex_lock(&lock);
+				s->failed = 1;
+				pthread_mutex_unlock(&lock);
+			}
+			return;
+		}
+		pthread_detach(th);
+		running = 1;
+	}
+	s->pending++;
+	*queue_tail = c;
+	queue_tail = &c->next;
+	pthread_cond_signal(&work);
+	pthread_mutex_unlock(&lock);
+}
+
+/* 0 if anything failed */
+int verify_finish(struct checks *s)
+{
+	int ok;
+	pthread_mutex_lock(&lock);
+	while(s->pending)
+		pthread_cond_wait(&done, &lock);
+	ok = !s->failed;
+	pthread_mutex_unlock(&lock);
+	free(s);
+	return ok;
+}
@@ -0,0 +1,193 @@
+/*
+ *	Copyright (C) 2013-2017 Jan Bobrowski <jb@wizard.ae.krakow.pl>
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	version 2 as published by the Free Software Foundation.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "ttf2woff.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#ifdef WIN32
+#define mkdir(P,M) mkdir(P)
+#endif
+
+/*
+ * Compressed tables are stored under the SHA-256 of the compressor
+ * settings and the uncompressed data, as dir/xx/xxxx...; an empty file
+ * records that the data didn't compress. Entries are written to a
+ * temporary name and renamed, so readers never see partial files.
+ */
+
+static char *cache_dir;
+
+void zcache_init(char *dir)
+{
+	if(mkdir(dir, 0777) < 0 && errno != EEXIST)
+		err(1, "%s", dir);
+	cache_dir = dir;
+}
+
+static char *entry_name(struct buf *inp, struct effort *e)
+{
+	static const char hex[] = "0123456789abcdef";
+	struct sha256 s;
+	char tb[16], *tag = e->comp->tag(tb, e);
+	u8 md[32];
+	char *nm, *p;
+	int i;
+
+	sha256_init(&s);
+	sha256_update(&s, tag, strlen(tag)+1);
+	sha256_update(&s, inp->ptr, inp->len);
+	sha256_final(&s, md);
+
+	nm = my_alloc(strlen(cache_dir) + 1 + 2 + 1 + 62 + 8);
+	p = nm + sprintf(nm, "%s/", cache_dir);
+	for(i=0; i<32; i++) {
+		if(i==1)
+			*p++ = '/';
+		*p++ = hex[md[i]>>4];
+		*p++ = hex[md[i]&15];
+	}
+	*p = 0;
+	return nm;
+}
+
+/* 1: hit, -1: miss */
+static int lookup(char *nm, struct buf *out, struct buf *inp)
+{
+	struct stat st;
+	uLongf len;
+	u8 *b, *tmp;
+	int fd, v;
+
+	fd = open(nm, O_RDONLY|O_BINARY);
+	if(fd < 0)
+		return -1;
+	if(fstat(fd, &st) < 0 || st.st_size >= inp->len) {
+		close(fd);
+		return -1;
+	}
+	if(!st.st_size) {
+		close(fd);
+		return 0;
+	}
+
+	b = my_alloc(st.st_size);
+	v = read(fd, b, st.st_size);
+	close(fd);
+	if(v != st.st_size)
+		goto bad;
+
+	/* the file could come from anywhere; don't put garbage into a font */
+	tmp = my_alloc(inp->len);
+	len = inp->len;
+	v = uncompress(tmp, &len, b, st.st_size);
+	if(v != Z_OK || len != inp->len || memcmp(tmp, inp->ptr, len)) {
+		my_free(tmp);
+		goto bad;
+	}
+	my_free(tmp);
+
+	out->ptr = b;
+	out->len = st.st_size;
+	return 1;
+
+bad:
+	my_free(b);
+	if(g.verbose)
+		echo("Ignoring bad cache entry %s", nm);
+	return -1;
+}
+
+static void store(char *nm, struct buf *data)
+{
+	int l = strlen(nm);
+	char *tmp = my_alloc(l + 24);
+	char *sl = strrchr(nm, '/');
+	int fd, i, v;
+
+	*sl = 0;
+	v = mkdir(nm, 0777);
+	*sl = '/';
+	if(v < 0 && errno != EEXIST)
+		goto failed;
+
+	for(i=0;; i++) {
+		sprintf(tmp, "%s.%d.%d", nm, (int)getpid(), i);
+		fd = open(tmp, O_WRONLY|O_CREAT|O_EXCL|O_BINARY, 0666);
+		if(fd >= 0)
+			break;
+		if(errno != EEXIST || i > 999)
+			goto failed;
+	}
+
+	v = data->len ? write(fd, data->ptr, data->len) : 0;
+	close(fd);
+	if(v != data->len) {
+		unlink(tmp);
+		goto failed;
+	}
+#ifdef WIN32
+	unlink(nm);
+#endif
+	if(rename(tmp, nm) < 0) {
+		unlink(tmp);
+		goto failed;
+	}
+	my_free(tmp);
+	return;
+
+failed:
+	echo("Can't write cache entry %s: %s", nm, strerror(errno));
+	my_free(tmp);
+}
+
+struct compressor *compressors[] = {
+	&comp_zlib,
+	&comp_zopfli,
+#ifdef LIBDEFLATE
+	&comp_libdeflate,
+#endif
+	0
+};
+
+struct compressor *find_compressor(char *name)
+{
+	struct compressor **c;
+	for(c=compressors; *c; c++)
+		if(strcmp((*c)->name, name)==0)
+			return *c;
+	return 0;
+}
+
+int zcache_compress(struct buf *out, struct buf *inp, struct effort *e)
+{
+	struct buf none = {0};
+	char *nm;
+	int v;
+
+	if(!cache_dir)
+		return e->comp->compress(out, inp, e);
+
+	nm = entry_name(inp, e);
+	v = lookup(nm, out, inp);
+	if(v < 0) {
+		v = e->comp->compress(out, inp, e);
+		if(!e->stopped) // cut short, not what the tag says
+			store(nm, v ? out : &none);
+	}
+	my_free(nm);
+	return v;
+}
@@ -282,11 +282,11 @@ void ZopfliBlockSplit(const ZopfliOptions* options,
   size_t nlz77points = 0;
   ZopfliLZ77Store store;
   ZopfliHash hash;
-  ZopfliHash* h = &hash;
+  ZopfliHash* h;
 
   ZopfliInitLZ77Store(in, &store);
   ZopfliInitBlockState(options, instart, inend, 0, &s);
-  ZopfliAllocHash(ZOPFLI_WINDOW_SIZE, h);
+  h = ZopfliGetHash(options->state, &hash);
 
   *npoints = 0;
   *splitpoints = 0;
@@ -316,7 +316,7 @@ void ZopfliBlockSplit(const ZopfliOptions* options,
   free(lz77splitpoints);
   ZopfliCleanBlockState(&s);
   ZopfliCleanLZ77Store(&store);
-  ZopfliCleanHash(h);
+  ZopfliPutHash(options->state, h);
 }
 
 void ZopfliBlockSplitSimple(const unsigned char* in,
@@ -25,24 +25,39 @@ Author: jyrki.alakuijala@gmail.com (Jyrki Alakuijala)
 
 #ifdef ZOPFLI_LONGEST_MATCH_CACHE
 
-void ZopfliInitCache(size_t blocksize, ZopfliLongestMatchCache* lmc) {
-  size_t i;
-  lmc->length = (unsigned short*)malloc(sizeof(unsigned short) * blocksize);
-  lmc->dist = (unsigned short*)malloc(sizeof(unsigned short) * blocksize);
+size_t ZopfliCacheSize(size_t blocksize, size_t limit) {
+  if (limit && blocksize > limit / ZOPFLI_CACHE_ENTRY_SIZE) {
+    return limit / ZOPFLI_CACHE_ENTRY_SIZE;
+  }
+  return blocksize;
+}
+
+void ZopfliInitCache(size_t size, ZopfliLongestMatchCache* lmc) {
+  /* malloc(0) may give NULL. */
+  size_t n = size ? size : 1;
+  lmc->length = (unsigned short*)malloc(sizeof(unsigned short) * n);
+  lmc->dist = (unsigned short*)malloc(sizeof(unsigned short) * n);
   /* Rather large amount of memory. */
-  lmc->sublen = (unsigned char*)malloc(ZOPFLI_CACHE_LENGTH * 3 * blocksize);
+  lmc->sublen = (unsigned char*)malloc(ZOPFLI_CACHE_LENGTH * 3 * n);
   if(lmc->sublen == NULL) {
     fprintf(stderr,
         "Error: Out of memory. Tried allocating %lu bytes of memory.\n",
-        (unsigned long)(ZOPFLI_CACHE_LENGTH * 3 * blocksize));
+        (unsigned long)(ZOPFLI_CACHE_LENGTH * 3 * n));
     exit (EXIT_FAILURE);
   }
 
+  ZopfliResetCache(size, lmc);
+}
+
+void ZopfliResetCache(size_t size, ZopfliLongestMatchCache* lmc) {
+  size_t i;
+
   /* length > 0 and dist 0 is invalid combination, which indicates on purpose
   that this cache value is not filled in yet. */
-  for (i = 0; i < blocksize; i++) lmc->length[i] = 1;
-  for (i = 0; i < blocksize; i++) lmc->dist[i] = 0;
-  for (i = 0; i < ZOPFLI_CACHE_LENGTH * blocksize * 3; i++) lmc->sublen[i] = 0;
+  for (i = 0; i < size; i++) lmc->length[i] = 1;
+  for (i = 0; i < size; i++) lmc->dist[i] = 0;
+  for (i = 0; i < ZOPFLI_CACHE_LENGTH * size * 3; i++) lmc->sublen[i] = 0;
+  lmc->size = size;
 }
 
 void ZopfliCleanCache(ZopfliLongestMatchCache* lmc) {
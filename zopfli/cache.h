@@ -35,15 +35,31 @@ This is needed because the squeeze runs will ask these values multiple times for
 the same position.
 Uses large amounts of memory, since it has to remember the distance belonging
 to every possible shorter-than-the-best length (the so called "sublen" array).
+It may cover only the first positions of the block: the others are not cached,
+which makes them slower but gives the same result.
 */
 typedef struct ZopfliLongestMatchCache {
   unsigned short* length;
   unsigned short* dist;
   unsigned char* sublen;
+  size_t size;  /* number of positions cached, from the start of the block */
 } ZopfliLongestMatchCache;
 
-/* Initializes the ZopfliLongestMatchCache. */
-void ZopfliInitCache(size_t blocksize, ZopfliLongestMatchCache* lmc);
+/* Bytes of cache per position. */
+#define ZOPFLI_CACHE_ENTRY_SIZE (2 * sizeof(unsigned short) + \
+                                 ZOPFLI_CACHE_LENGTH * 3)
+
+/*
+Returns how many positions of a block of blocksize to cache so that the cache
+takes at most limit bytes (0 for no limit).
+*/
+size_t ZopfliCacheSize(size_t blocksize, size_t limit);
+
+/* Initializes the ZopfliLongestMatchCache for size positions. */
+void ZopfliInitCache(size_t size, ZopfliLongestMatchCache* lmc);
+
+/* Empties a cache allocated for at least size positions, for reuse. */
+void ZopfliResetCache(size_t size, ZopfliLongestMatchCache* lmc);
 
 /* Frees up the memory of the ZopfliLongestMatchCache. */
 void ZopfliCleanCache(ZopfliLongestMatchCache* lmc);
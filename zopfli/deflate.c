@@ -746,12 +746,14 @@ static void AddLZ77Block(const ZopfliOptions* options, int btype, int final,
   }
 }
 
-static void AddLZ77BlockAutoType(const ZopfliOptions* options, int final,
-                                 const ZopfliLZ77Store* lz77,
-                                 size_t lstart, size_t lend,
-                                 size_t expected_data_size,
-                                 unsigned char* bp,
-                                 unsigned char** out, size_t* outsize) {
+/*
+Chooses the type of a block: 0, 1 or 2. For type 1, fixedstore may get a
+better LZ77 for the fixed tree; then it isn't empty.
+*/
+static int ChooseBlockType(const ZopfliOptions* options,
+                           const ZopfliLZ77Store* lz77,
+                           size_t lstart, size_t lend,
+                           ZopfliLZ77Store* fixedstore) {
   double uncompressedcost = ZopfliCalculateBlockSize(lz77, lstart, lend, 0);
   double fixedcost = ZopfliCalculateBlockSize(lz77, lstart, lend, 1);
   double dyncost = ZopfliCalculateBlockSize(lz77, lstart, lend, 2);
@@ -761,15 +763,10 @@ static void AddLZ77BlockAutoType(const ZopfliOptions* options, int final,
   blocks which already are pretty good with fixed huffman tree. */
   int expensivefixed = (lz77->size < 1000) || fixedcost <= dyncost * 1.1;
 
-  ZopfliLZ77Store fixedstore;
   if (lstart == lend) {
     /* Smallest empty block is represented by fixed block */
-    AddBits(final, 1, bp, out, outsize);
-    AddBits(1, 2, bp, out, outsize);  /* btype 01 */
-    AddBits(0, 7, bp, out, outsize);  /* end symbol has code 0000000 */
-    return;
+    return 1;
   }
-  ZopfliInitLZ77Store(lz77->data, &fixedstore);
   if (expensivefixed) {
     /* Recalculate the LZ77 with ZopfliLZ77OptimalFixed */
     size_t instart = lz77->pos[lstart];
@@ -777,43 +774,64 @@ static void AddLZ77BlockAutoType(const ZopfliOptions* options, int final,
 
     ZopfliBlockState s;
     ZopfliInitBlockState(options, instart, inend, 1, &s);
-    ZopfliLZ77OptimalFixed(&s, lz77->data, instart, inend, &fixedstore);
-    fixedcost = ZopfliCalculateBlockSize(&fixedstore, 0, fixedstore.size, 1);
+    ZopfliLZ77OptimalFixed(&s, lz77->data, instart, inend, fixedstore);
+    fixedcost = ZopfliCalculateBlockSize(fixedstore, 0, fixedstore->size, 1);
     ZopfliCleanBlockState(&s);
   }
 
   if (uncompressedcost < fixedcost && uncompressedcost < dyncost) {
-    AddLZ77Block(options, 0, final, lz77, lstart, lend,
-                 expected_data_size, bp, out, outsize);
+    return 0;
   } else if (fixedcost < dyncost) {
-    if (expensivefixed) {
-      AddLZ77Block(options, 1, final, &fixedstore, 0, fixedstore.size,
-                   expected_data_size, bp, out, outsize);
-    } else {
-      AddLZ77Block(options, 1, final, lz77, lstart, lend,
-                   expected_data_size, bp, out, outsize);
-    }
+    return 1;
+  }
+  return 2;
+}
+
+/*
+Adds a block of the type chosen by ChooseBlockType, with its fixedstore.
+*/
+static void AddLZ77BlockOfType(const ZopfliOptions* options, int btype,
+                               int final,
+                               const ZopfliLZ77Store* lz77,
+                               size_t lstart, size_t lend,
+                               const ZopfliLZ77Store* fixedstore,
+                               size_t expected_data_size,
+                               unsigned char* bp,
+                               unsigned char** out, size_t* outsize) {
+  if (lstart == lend) {
+    /* Smallest empty block is represented by fixed block */
+    AddBits(final, 1, bp, out, outsize);
+    AddBits(1, 2, bp, out, outsize);  /* btype 01 */
+    AddBits(0, 7, bp, out, outsize);  /* end symbol has code 0000000 */
+    return;
+  }
+  if (btype == 1 && fixedstore->size > 0) {
+    AddLZ77Block(options, 1, final, fixedstore, 0, fixedstore->size,
+                 expected_data_size, bp, out, outsize);
   } else {
-    AddLZ77Block(options, 2, final, lz77, lstart, lend,
+    AddLZ77Block(options, btype, final, lz77, lstart, lend,
                  expected_data_size, bp, out, outsize);
   }
-
-  ZopfliCleanLZ77Store(&fixedstore);
 }
 
 /*
-Deflate a part, to allow ZopfliDeflate() to use multiple master blocks if
-needed.
-It is possible to call this function multiple times in a row, shifting
-instart and inend to next bytes of the data. If instart is larger than 0, then
-previous bytes are used as the initial dictionary for LZ77.
-This function will usually output multiple deflate blocks. If final is 1, then
-the final bit will be set on the last block.
+The LZ77 of a master block with the blocks it is split into and their types,
+ready to be written.
 */
-void ZopfliDeflatePart(const ZopfliOptions* options, int btype, int final,
-                       const unsigned char* in, size_t instart, size_t inend,
-                       unsigned char* bp, unsigned char** out,
-                       size_t* outsize) {
+typedef struct ZopfliPart {
+  ZopfliLZ77Store lz77;
+  size_t* splitpoints;  /* lz77 indices */
+  size_t npoints;
+  int* btypes;  /* npoints + 1 */
+  ZopfliLZ77Store* fixedstores;  /* npoints + 1 */
+} ZopfliPart;
+
+/*
+Does the work of ZopfliDeflatePart with btype 2, except for the output.
+*/
+static void PlanPart(const ZopfliOptions* options,
+                     const unsigned char* in, size_t instart, size_t inend,
+                     ZopfliPart* part) {
   size_t i;
   /* byte coordinates rather than lz77 index */
   size_t* splitpoints_uncompressed = 0;
@@ -822,28 +840,6 @@ void ZopfliDeflatePart(const ZopfliOptions* options, int btype, int final,
   double totalcost = 0;
   ZopfliLZ77Store lz77;
 
-  /* If btype=2 is specified, it tries all block types. If a lesser btype is
-  given, then however it forces that one. Neither of the lesser types needs
-  block splitting as they have no dynamic huffman trees. */
-  if (btype == 0) {
-    AddNonCompressedBlock(options, final, in, instart, inend, bp, out, outsize);
-    return;
-  } else if (btype == 1) {
-    ZopfliLZ77Store store;
-    ZopfliBlockState s;
-    ZopfliInitLZ77Store(in, &store);
-    ZopfliInitBlockState(options, instart, inend, 1, &s);
-
-    ZopfliLZ77OptimalFixed(&s, in, instart, inend, &store);
-    AddLZ77Block(options, btype, final, &store, 0, store.size, 0,
-                 bp, out, outsize);
-
-    ZopfliCleanBlockState(&s);
-    ZopfliCleanLZ77Store(&store);
-    return;
-  }
-
-
   if (options->blocksplitting) {
     ZopfliBlockSplit(options, in, instart, inend,
                      options->blocksplittingmax,
@@ -894,19 +890,141 @@ void ZopfliDeflatePart(const ZopfliOptions* options, int btype, int final,
     }
   }
 
+  part->btypes = (int*)malloc(sizeof(*part->btypes) * (npoints + 1));
+  part->fixedstores = (ZopfliLZ77Store*)malloc(
+      sizeof(*part->fixedstores) * (npoints + 1));
+  if (!part->btypes || !part->fixedstores) exit(-1); /* Allocation failed. */
   for (i = 0; i <= npoints; i++) {
     size_t start = i == 0 ? 0 : splitpoints[i - 1];
     size_t end = i == npoints ? lz77.size : splitpoints[i];
-    AddLZ77BlockAutoType(options, i == npoints && final,
-                         &lz77, start, end, 0,
-                         bp, out, outsize);
+    ZopfliInitLZ77Store(in, &part->fixedstores[i]);
+    part->btypes[i] = ChooseBlockType(options, &lz77, start, end,
+                                      &part->fixedstores[i]);
   }
 
-  ZopfliCleanLZ77Store(&lz77);
-  free(splitpoints);
+  part->lz77 = lz77;
+  part->splitpoints = splitpoints;
+  part->npoints = npoints;
   free(splitpoints_uncompressed);
 }
 
+/*
+Writes out a planned part and frees it.
+*/
+static void WritePart(const ZopfliOptions* options, int final,
+                      ZopfliPart* part,
+                      unsigned char* bp, unsigned char** out,
+                      size_t* outsize) {
+  size_t i;
+  for (i = 0; i <= part->npoints; i++) {
+    size_t start = i == 0 ? 0 : part->splitpoints[i - 1];
+    size_t end = i == part->npoints ? part->lz77.size : part->splitpoints[i];
+    AddLZ77BlockOfType(options, part->btypes[i], i == part->npoints && final,
+                       &part->lz77, start, end, &part->fixedstores[i], 0,
+                       bp, out, outsize);
+    ZopfliCleanLZ77Store(&part->fixedstores[i]);
+  }
+
+  ZopfliCleanLZ77Store(&part->lz77);
+  free(part->splitpoints);
+  free(part->btypes);
+  free(part->fixedstores);
+}
+
+/*
+Deflate a part, to allow ZopfliDeflate() to use multiple master blocks if
+needed.
+It is possible to call this function multiple times in a row, shifting
+instart and inend to next bytes of the data. If instart is larger than 0, then
+previous bytes are used as the initial dictionary for LZ77.
+This function will usually output multiple deflate blocks. If final is 1, then
+the final bit will be set on the last block.
+*/
+void ZopfliDeflatePart(const ZopfliOptions* options, int btype, int final,
+                       const unsigned char* in, size_t instart, size_t inend,
+                       unsigned char* bp, unsigned char** out,
+                       size_t* outsize) {
+  ZopfliPart part;
+
+  /* If btype=2 is specified, it tries all block types. If a lesser btype is
+  given, then however it forces that one. Neither of the lesser types needs
+  block splitting as they have no dynamic huffman trees. */
+  if (btype == 0) {
+    AddNonCompressedBlock(options, final, in, instart, inend, bp, out, outsize);
+    return;
+  } else if (btype == 1) {
+    ZopfliLZ77Store store;
+    ZopfliBlockState s;
+    ZopfliInitLZ77Store(in, &store);
+    ZopfliInitBlockState(options, instart, inend, 1, &s);
+
+    ZopfliLZ77OptimalFixed(&s, in, instart, inend, &store);
+    AddLZ77Block(options, btype, final, &store, 0, store.size, 0,
+                 bp, out, outsize);
+
+    ZopfliCleanBlockState(&s);
+    ZopfliCleanLZ77Store(&store);
+    return;
+  }
+
+  PlanPart(options, in, instart, inend, &part);
+  WritePart(options, final, &part, bp, out, outsize);
+}
+
+#if ZOPFLI_MASTER_BLOCK_SIZE != 0
+typedef struct ParallelParts {
+  const ZopfliOptions* options;
+  const unsigned char* in;
+  size_t insize;
+  size_t first;  /* master block of parts[0] */
+  ZopfliPart* parts;
+} ParallelParts;
+
+static void PlanPartJob(void* arg, int i) {
+  ParallelParts* p = (ParallelParts*)arg;
+  size_t start = (p->first + i) * ZOPFLI_MASTER_BLOCK_SIZE;
+  size_t end = start + ZOPFLI_MASTER_BLOCK_SIZE;
+  /* This thread's state, if any; the caller's is not to be shared. */
+  ZopfliOptions options = *p->options;
+  options.state = options.thread_state ? options.thread_state() : 0;
+  if (end > p->insize) end = p->insize;
+  PlanPart(&options, p->in, start, end, &p->parts[i]);
+}
+
+/*
+Plans options->parallel_blocks master blocks at a time with options->parallel,
+then writes them in order before going on to the next ones, so that no more
+than that many are held in memory. Each master block still sees the data
+before it as its dictionary, so the output is the same as when they are done
+one after another.
+*/
+static void DeflateParallel(const ZopfliOptions* options, int final,
+                            const unsigned char* in, size_t insize,
+                            unsigned char* bp, unsigned char** out,
+                            size_t* outsize) {
+  size_t n = (insize + ZOPFLI_MASTER_BLOCK_SIZE - 1) / ZOPFLI_MASTER_BLOCK_SIZE;
+  size_t batch = options->parallel_blocks;
+  size_t i;
+  ParallelParts p;
+  if (batch > n) batch = n;
+  p.options = options;
+  p.in = in;
+  p.insize = insize;
+  p.parts = (ZopfliPart*)malloc(sizeof(*p.parts) * batch);
+  if (!p.parts) exit(-1); /* Allocation failed. */
+
+  for (p.first = 0; p.first < n; p.first += batch) {
+    size_t count = n - p.first < batch ? n - p.first : batch;
+    options->parallel(PlanPartJob, &p, (int)count);
+    for (i = 0; i < count; i++) {
+      WritePart(options, final && p.first + i == n - 1, &p.parts[i],
+                bp, out, outsize);
+    }
+  }
+  free(p.parts);
+}
+#endif
+
 void ZopfliDeflate(const ZopfliOptions* options, int btype, int final,
                    const unsigned char* in, size_t insize,
                    unsigned char* bp, unsigned char** out, size_t* outsize) {
@@ -915,14 +1033,19 @@ void ZopfliDeflate(const ZopfliOptions* options, int btype, int final,
   ZopfliDeflatePart(options, btype, final, in, 0, insize, bp, out, outsize);
 #else
   size_t i = 0;
-  do {
-    int masterfinal = (i + ZOPFLI_MASTER_BLOCK_SIZE >= insize);
-    int final2 = final && masterfinal;
-    size_t size = masterfinal ? insize - i : ZOPFLI_MASTER_BLOCK_SIZE;
-    ZopfliDeflatePart(options, btype, final2,
-                      in, i, i + size, bp, out, outsize);
-    i += size;
-  } while (i < insize);
+  if (options->parallel && options->parallel_blocks > 1 && btype == 2 &&
+      insize > ZOPFLI_MASTER_BLOCK_SIZE) {
+    DeflateParallel(options, final, in, insize, bp, out, outsize);
+  } else {
+    do {
+      int masterfinal = (i + ZOPFLI_MASTER_BLOCK_SIZE >= insize);
+      int final2 = final && masterfinal;
+      size_t size = masterfinal ? insize - i : ZOPFLI_MASTER_BLOCK_SIZE;
+      ZopfliDeflatePart(options, btype, final2,
+                        in, i, i + size, bp, out, outsize);
+      i += size;
+    } while (i < insize);
+  }
 #endif
   if (options->verbose) {
     fprintf(stderr,
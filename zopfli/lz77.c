@@ -24,6 +24,13 @@ Author: jyrki.alakuijala@gmail.com (Jyrki Alakuijala)
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+    && !defined(ZOPFLI_NO_SIMD)
+#define ZOPFLI_MATCH_SIMD
+#include <immintrin.h>
+#endif
 
 void ZopfliInitLZ77Store(const unsigned char* data, ZopfliLZ77Store* store) {
   store->size = 0;
@@ -35,6 +42,12 @@ void ZopfliInitLZ77Store(const unsigned char* data, ZopfliLZ77Store* store) {
   store->d_symbol = 0;
   store->ll_counts = 0;
   store->d_counts = 0;
+  store->allocated = 0;
+}
+
+void ZopfliResetLZ77Store(const unsigned char* data, ZopfliLZ77Store* store) {
+  store->size = 0;
+  store->data = data;
 }
 
 void ZopfliCleanLZ77Store(ZopfliLZ77Store* store) {
@@ -51,29 +64,40 @@ static size_t CeilDiv(size_t a, size_t b) {
   return (a + b - 1) / b;
 }
 
+/* Makes room for n symbols in all the arrays. */
+static void GrowLZ77Store(ZopfliLZ77Store* store, size_t n) {
+  size_t llsize = ZOPFLI_NUM_LL * CeilDiv(n, ZOPFLI_NUM_LL);
+  size_t dsize = ZOPFLI_NUM_D * CeilDiv(n, ZOPFLI_NUM_D);
+  store->litlens = (unsigned short*)realloc(store->litlens,
+      sizeof(*store->litlens) * n);
+  store->dists = (unsigned short*)realloc(store->dists,
+      sizeof(*store->dists) * n);
+  store->pos = (size_t*)realloc(store->pos, sizeof(*store->pos) * n);
+  store->ll_symbol = (unsigned short*)realloc(store->ll_symbol,
+      sizeof(*store->ll_symbol) * n);
+  store->d_symbol = (unsigned short*)realloc(store->d_symbol,
+      sizeof(*store->d_symbol) * n);
+  store->ll_counts = (size_t*)realloc(store->ll_counts,
+      sizeof(*store->ll_counts) * llsize);
+  store->d_counts = (size_t*)realloc(store->d_counts,
+      sizeof(*store->d_counts) * dsize);
+
+  /* Allocation failed. */
+  if (!store->litlens || !store->dists) exit(-1);
+  if (!store->pos) exit(-1);
+  if (!store->ll_symbol || !store->d_symbol) exit(-1);
+  if (!store->ll_counts || !store->d_counts) exit(-1);
+
+  store->allocated = n;
+}
+
 void ZopfliCopyLZ77Store(
     const ZopfliLZ77Store* source, ZopfliLZ77Store* dest) {
   size_t i;
   size_t llsize = ZOPFLI_NUM_LL * CeilDiv(source->size, ZOPFLI_NUM_LL);
   size_t dsize = ZOPFLI_NUM_D * CeilDiv(source->size, ZOPFLI_NUM_D);
-  ZopfliCleanLZ77Store(dest);
-  ZopfliInitLZ77Store(source->data, dest);
-  dest->litlens =
-      (unsigned short*)malloc(sizeof(*dest->litlens) * source->size);
-  dest->dists = (unsigned short*)malloc(sizeof(*dest->dists) * source->size);
-  dest->pos = (size_t*)malloc(sizeof(*dest->pos) * source->size);
-  dest->ll_symbol =
-      (unsigned short*)malloc(sizeof(*dest->ll_symbol) * source->size);
-  dest->d_symbol =
-      (unsigned short*)malloc(sizeof(*dest->d_symbol) * source->size);
-  dest->ll_counts = (size_t*)malloc(sizeof(*dest->ll_counts) * llsize);
-  dest->d_counts = (size_t*)malloc(sizeof(*dest->d_counts) * dsize);
-
-  /* Allocation failed. */
-  if (!dest->litlens || !dest->dists) exit(-1);
-  if (!dest->pos) exit(-1);
-  if (!dest->ll_symbol || !dest->d_symbol) exit(-1);
-  if (!dest->ll_counts || !dest->d_counts) exit(-1);
+  ZopfliResetLZ77Store(source->data, dest);
+  if (dest->allocated < source->size) GrowLZ77Store(dest, source->size);
 
   dest->size = source->size;
   for (i = 0; i < source->size; i++) {
@@ -98,54 +122,47 @@ context must be a ZopfliLZ77Store*.
 void ZopfliStoreLitLenDist(unsigned short length, unsigned short dist,
                            size_t pos, ZopfliLZ77Store* store) {
   size_t i;
-  /* Needed for using ZOPFLI_APPEND_DATA multiple times. */
   size_t origsize = store->size;
   size_t llstart = ZOPFLI_NUM_LL * (origsize / ZOPFLI_NUM_LL);
   size_t dstart = ZOPFLI_NUM_D * (origsize / ZOPFLI_NUM_D);
 
+  /* Room is kept in all arrays at once, so that a reset store can be reused. */
+  if (origsize == store->allocated) {
+    GrowLZ77Store(store, origsize ? origsize * 2 : 256);
+  }
+
   /* Everytime the index wraps around, a new cumulative histogram is made: we're
   keeping one histogram value per LZ77 symbol rather than a full histogram for
   each to save memory. */
   if (origsize % ZOPFLI_NUM_LL == 0) {
-    size_t llsize = origsize;
     for (i = 0; i < ZOPFLI_NUM_LL; i++) {
-      ZOPFLI_APPEND_DATA(
-          origsize == 0 ? 0 : store->ll_counts[origsize - ZOPFLI_NUM_LL + i],
-          &store->ll_counts, &llsize);
+      store->ll_counts[origsize + i] =
+          origsize == 0 ? 0 : store->ll_counts[origsize - ZOPFLI_NUM_LL + i];
     }
   }
   if (origsize % ZOPFLI_NUM_D == 0) {
-    size_t dsize = origsize;
     for (i = 0; i < ZOPFLI_NUM_D; i++) {
-      ZOPFLI_APPEND_DATA(
-          origsize == 0 ? 0 : store->d_counts[origsize - ZOPFLI_NUM_D + i],
-          &store->d_counts, &dsize);
+      store->d_counts[origsize + i] =
+          origsize == 0 ? 0 : store->d_counts[origsize - ZOPFLI_NUM_D + i];
     }
   }
 
-  ZOPFLI_APPEND_DATA(length, &store->litlens, &store->size);
-  store->size = origsize;
-  ZOPFLI_APPEND_DATA(dist, &store->dists, &store->size);
-  store->size = origsize;
-  ZOPFLI_APPEND_DATA(pos, &store->pos, &store->size);
+  store->litlens[origsize] = length;
+  store->dists[origsize] = dist;
+  store->pos[origsize] = pos;
   assert(length < 259);
 
   if (dist == 0) {
-    store->size = origsize;
-    ZOPFLI_APPEND_DATA(length, &store->ll_symbol, &store->size);
-    store->size = origsize;
-    ZOPFLI_APPEND_DATA(0, &store->d_symbol, &store->size);
+    store->ll_symbol[origsize] = length;
+    store->d_symbol[origsize] = 0;
     store->ll_counts[llstart + length]++;
   } else {
-    store->size = origsize;
-    ZOPFLI_APPEND_DATA(ZopfliGetLengthSymbol(length),
-                       &store->ll_symbol, &store->size);
-    store->size = origsize;
-    ZOPFLI_APPEND_DATA(ZopfliGetDistSymbol(dist),
-                       &store->d_symbol, &store->size);
+    store->ll_symbol[origsize] = ZopfliGetLengthSymbol(length);
+    store->d_symbol[origsize] = ZopfliGetDistSymbol(dist);
     store->ll_counts[llstart + ZopfliGetLengthSymbol(length)]++;
     store->d_counts[dstart + ZopfliGetDistSymbol(dist)]++;
   }
+  store->size = origsize + 1;
 }
 
 void ZopfliAppendLZ77Store(const ZopfliLZ77Store* store,
@@ -223,9 +240,24 @@ void ZopfliInitBlockState(const ZopfliOptions* options,
   s->blockstart = blockstart;
   s->blockend = blockend;
 #ifdef ZOPFLI_LONGEST_MATCH_CACHE
-  if (add_lmc) {
+  ZopfliState* state = options->state;
+  size_t size = ZopfliCacheSize(blockend - blockstart, options->cache_limit);
+  if (add_lmc && size == 0) {
+    s->lmc = 0;
+  } else if (add_lmc && state && !state->lmc_busy) {
+    if (state->lmc_size < size) {
+      if (state->lmc_size) ZopfliCleanCache(&state->lmc);
+      state->lmc_size = 0;
+      ZopfliInitCache(size, &state->lmc);
+      state->lmc_size = size;
+    } else {
+      ZopfliResetCache(size, &state->lmc);
+    }
+    state->lmc_busy = 1;
+    s->lmc = &state->lmc;
+  } else if (add_lmc) {
     s->lmc = (ZopfliLongestMatchCache*)malloc(sizeof(ZopfliLongestMatchCache));
-    ZopfliInitCache(blockend - blockstart, s->lmc);
+    ZopfliInitCache(size, s->lmc);
   } else {
     s->lmc = 0;
   }
@@ -234,13 +266,72 @@ void ZopfliInitBlockState(const ZopfliOptions* options,
 
 void ZopfliCleanBlockState(ZopfliBlockState* s) {
 #ifdef ZOPFLI_LONGEST_MATCH_CACHE
-  if (s->lmc) {
+  ZopfliState* state = s->options->state;
+  if (state && s->lmc == &state->lmc) {
+    state->lmc_busy = 0;
+  } else if (s->lmc) {
     ZopfliCleanCache(s->lmc);
     free(s->lmc);
   }
 #endif
 }
 
+void ZopfliInitState(ZopfliState* state) {
+  memset(state, 0, sizeof(*state));
+  ZopfliInitLZ77Store(0, &state->store);
+}
+
+void ZopfliCleanState(ZopfliState* state) {
+  if (state->hash_allocated) ZopfliCleanHash(&state->hash);
+#ifdef ZOPFLI_LONGEST_MATCH_CACHE
+  if (state->lmc_size) ZopfliCleanCache(&state->lmc);
+#endif
+  ZopfliCleanLZ77Store(&state->store);
+  free(state->length_array);
+  free(state->costs);
+}
+
+ZopfliHash* ZopfliGetHash(ZopfliState* state, ZopfliHash* own) {
+  if (!state || state->hash_busy) {
+    ZopfliAllocHash(ZOPFLI_WINDOW_SIZE, own);
+    return own;
+  }
+  if (!state->hash_allocated) {
+    ZopfliAllocHash(ZOPFLI_WINDOW_SIZE, &state->hash);
+    state->hash_allocated = 1;
+  }
+  state->hash_busy = 1;
+  return &state->hash;
+}
+
+void ZopfliPutHash(ZopfliState* state, ZopfliHash* h) {
+  if (state && h == &state->hash) {
+    state->hash_busy = 0;
+  } else {
+    ZopfliCleanHash(h);
+  }
+}
+
+ZopfliLZ77Store* ZopfliGetLZ77Store(ZopfliState* state,
+                                    const unsigned char* data,
+                                    ZopfliLZ77Store* own) {
+  if (!state || state->store_busy) {
+    ZopfliInitLZ77Store(data, own);
+    return own;
+  }
+  ZopfliResetLZ77Store(data, &state->store);
+  state->store_busy = 1;
+  return &state->store;
+}
+
+void ZopfliPutLZ77Store(ZopfliState* state, ZopfliLZ77Store* store) {
+  if (state && store == &state->store) {
+    state->store_busy = 0;
+  } else {
+    ZopfliCleanLZ77Store(store);
+  }
+}
+
 /*
 Gets a score of the length given the distance. Typically, the score of the
 length is the length itself, but if the distance is very long, decrease the
@@ -330,6 +421,59 @@ static const unsigned char* GetMatch(const unsigned char* scan,
   return scan;
 }
 
+#ifdef ZOPFLI_MATCH_SIMD
+/*
+Like GetMatch, but compares 16 (SSE2) or 32 (AVX2) bytes per step and finds
+the first difference from the compare mask. The kernel is picked at run time,
+by what the CPU supports.
+*/
+__attribute__((target("sse2")))
+static const unsigned char* GetMatchSSE2(const unsigned char* scan,
+                                         const unsigned char* match,
+                                         const unsigned char* end,
+                                         const unsigned char* safe_end) {
+  while (end - scan >= 16) {
+    __m128i a = _mm_loadu_si128((const __m128i*)scan);
+    __m128i b = _mm_loadu_si128((const __m128i*)match);
+    unsigned diff = ~_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) & 0xFFFF;
+    if (diff) return scan + __builtin_ctz(diff);
+    scan += 16;
+    match += 16;
+  }
+  return GetMatch(scan, match, end, safe_end);
+}
+
+__attribute__((target("avx2")))
+static const unsigned char* GetMatchAVX2(const unsigned char* scan,
+                                         const unsigned char* match,
+                                         const unsigned char* end,
+                                         const unsigned char* safe_end) {
+  while (end - scan >= 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)scan);
+    __m256i b = _mm256_loadu_si256((const __m256i*)match);
+    unsigned diff = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+    if (diff) return scan + __builtin_ctz(diff);
+    scan += 32;
+    match += 32;
+  }
+  return GetMatchSSE2(scan, match, end, safe_end);
+}
+
+enum { MATCH_UNKNOWN, MATCH_SCALAR, MATCH_SSE2, MATCH_AVX2 };
+static int match_kernel;
+
+static int GetMatchKernel(void) {
+  int k = __atomic_load_n(&match_kernel, __ATOMIC_RELAXED);
+  if (k == MATCH_UNKNOWN) {
+    __builtin_cpu_init();
+    k = __builtin_cpu_supports("avx2") ? MATCH_AVX2
+      : __builtin_cpu_supports("sse2") ? MATCH_SSE2 : MATCH_SCALAR;
+    __atomic_store_n(&match_kernel, k, __ATOMIC_RELAXED);
+  }
+  return k;
+}
+#endif
+
 #ifdef ZOPFLI_LONGEST_MATCH_CACHE
 /*
 Gets distance, length and sublen values from the cache if possible.
@@ -343,10 +487,11 @@ static int TryGetFromLongestMatchCache(ZopfliBlockState* s,
   /* The LMC cache starts at the beginning of the block rather than the
      beginning of the whole array. */
   size_t lmcpos = pos - s->blockstart;
+  int cached = s->lmc && lmcpos < s->lmc->size;
 
   /* Length > 0 and dist 0 is invalid combination, which indicates on purpose
      that this cache value is not filled in yet. */
-  unsigned char cache_available = s->lmc && (s->lmc->length[lmcpos] == 0 ||
+  unsigned char cache_available = cached && (s->lmc->length[lmcpos] == 0 ||
       s->lmc->dist[lmcpos] != 0);
   unsigned char limit_ok_for_cache = cache_available &&
       (*limit == ZOPFLI_MAX_MATCH || s->lmc->length[lmcpos] <= *limit ||
@@ -388,13 +533,14 @@ static void StoreInLongestMatchCache(ZopfliBlockState* s,
   /* The LMC cache starts at the beginning of the block rather than the
      beginning of the whole array. */
   size_t lmcpos = pos - s->blockstart;
+  int cached = s->lmc && lmcpos < s->lmc->size;
 
   /* Length > 0 and dist 0 is invalid combination, which indicates on purpose
      that this cache value is not filled in yet. */
-  unsigned char cache_available = s->lmc && (s->lmc->length[lmcpos] == 0 ||
+  unsigned char cache_available = cached && (s->lmc->length[lmcpos] == 0 ||
       s->lmc->dist[lmcpos] != 0);
 
-  if (s->lmc && limit == ZOPFLI_MAX_MATCH && sublen && !cache_available) {
+  if (cached && limit == ZOPFLI_MAX_MATCH && sublen && !cache_available) {
     assert(s->lmc->length[lmcpos] == 1 && s->lmc->dist[lmcpos] == 0);
     s->lmc->dist[lmcpos] = length < ZOPFLI_MIN_MATCH ? 0 : distance;
     s->lmc->length[lmcpos] = length < ZOPFLI_MIN_MATCH ? 0 : length;
@@ -418,6 +564,9 @@ void ZopfliFindLongestMatch(ZopfliBlockState* s, const ZopfliHash* h,
 #if ZOPFLI_MAX_CHAIN_HITS < ZOPFLI_WINDOW_SIZE
   int chain_counter = ZOPFLI_MAX_CHAIN_HITS;  /* For quitting early. */
 #endif
+#ifdef ZOPFLI_MATCH_SIMD
+  int kernel = GetMatchKernel();
+#endif
 
   unsigned dist = 0;  /* Not unsigned short on purpose. */
 
@@ -487,6 +636,13 @@ void ZopfliFindLongestMatch(ZopfliBlockState* s, const ZopfliHash* h,
           scan += same;
           match += same;
         }
+#endif
+#ifdef ZOPFLI_MATCH_SIMD
+        if (kernel == MATCH_AVX2)
+          scan = GetMatchAVX2(scan, match, arrayend, arrayend_safe);
+        else if (kernel == MATCH_SSE2)
+          scan = GetMatchSSE2(scan, match, arrayend, arrayend_safe);
+        else
 #endif
         scan = GetMatch(scan, match, arrayend, arrayend_safe);
         currentlength = scan - &array[pos];  /* The found length. */
@@ -59,9 +59,13 @@ typedef struct ZopfliLZ77Store {
   looping through the actual symbols of this chunk. */
   size_t* ll_counts;
   size_t* d_counts;
+
+  size_t allocated;  /* room in the arrays, in symbols */
 } ZopfliLZ77Store;
 
 void ZopfliInitLZ77Store(const unsigned char* data, ZopfliLZ77Store* store);
+/* Empties the store, keeping its memory. */
+void ZopfliResetLZ77Store(const unsigned char* data, ZopfliLZ77Store* store);
 void ZopfliCleanLZ77Store(ZopfliLZ77Store* store);
 void ZopfliCopyLZ77Store(const ZopfliLZ77Store* source, ZopfliLZ77Store* dest);
 void ZopfliStoreLitLenDist(unsigned short length, unsigned short dist,
@@ -101,6 +105,43 @@ void ZopfliInitBlockState(const ZopfliOptions* options,
                           ZopfliBlockState* s);
 void ZopfliCleanBlockState(ZopfliBlockState* s);
 
+/*
+Memory kept from one compression to the next, so that the hash, the longest
+match cache, the LZ77 store of the squeeze iterations and its cost arrays are
+reset rather than allocated and freed each time. Set ZopfliOptions.state to
+use one; it serves one compression at a time, so have one per thread. What is
+in use already is allocated as usual.
+*/
+typedef struct ZopfliState {
+  ZopfliHash hash;
+  int hash_allocated;
+  int hash_busy;
+#ifdef ZOPFLI_LONGEST_MATCH_CACHE
+  ZopfliLongestMatchCache lmc;
+  size_t lmc_size;
+  int lmc_busy;
+#endif
+  ZopfliLZ77Store store;
+  int store_busy;
+  unsigned short* length_array;
+  float* costs;
+  size_t arrays_size;
+  int arrays_busy;
+} ZopfliState;
+
+void ZopfliInitState(ZopfliState* state);
+void ZopfliCleanState(ZopfliState* state);
+
+/* A hash from the state if there is one and it's free, otherwise own. */
+ZopfliHash* ZopfliGetHash(ZopfliState* state, ZopfliHash* own);
+void ZopfliPutHash(ZopfliState* state, ZopfliHash* h);
+
+/* Likewise, an empty LZ77 store. */
+ZopfliLZ77Store* ZopfliGetLZ77Store(ZopfliState* state,
+                                    const unsigned char* data,
+                                    ZopfliLZ77Store* own);
+void ZopfliPutLZ77Store(ZopfliState* state, ZopfliLZ77Store* store);
+
 /*
 Finds the longest match (length and corresponding distance) for LZ77
 compression.
@@ -443,22 +443,60 @@ static double LZ77OptimalRun(ZopfliBlockState* s,
   return cost;
 }
 
+/*
+Gets the length_array and costs arrays for a block of blocksize, from the
+state if it has them free, otherwise newly allocated.
+*/
+static void GetArrays(ZopfliState* state, size_t blocksize,
+                      unsigned short** length_array, float** costs) {
+  if (state && !state->arrays_busy) {
+    if (state->arrays_size < blocksize + 1) {
+      free(state->length_array);
+      free(state->costs);
+      state->length_array = (unsigned short*)malloc(
+          sizeof(unsigned short) * (blocksize + 1));
+      state->costs = (float*)malloc(sizeof(float) * (blocksize + 1));
+      state->arrays_size = blocksize + 1;
+    }
+    state->arrays_busy = 1;
+    *length_array = state->length_array;
+    *costs = state->costs;
+  } else {
+    *length_array =
+        (unsigned short*)malloc(sizeof(unsigned short) * (blocksize + 1));
+    *costs = (float*)malloc(sizeof(float) * (blocksize + 1));
+  }
+  if (!*costs) exit(-1); /* Allocation failed. */
+  if (!*length_array) exit(-1); /* Allocation failed. */
+}
+
+static void PutArrays(ZopfliState* state,
+                      unsigned short* length_array, float* costs) {
+  if (state && length_array == state->length_array) {
+    state->arrays_busy = 0;
+  } else {
+    free(length_array);
+    free(costs);
+  }
+}
+
 void ZopfliLZ77Optimal(ZopfliBlockState *s,
                        const unsigned char* in, size_t instart, size_t inend,
                        int numiterations,
                        ZopfliLZ77Store* store) {
   /* Dist to get to here with smallest cost. */
   size_t blocksize = inend - instart;
-  unsigned short* length_array =
-      (unsigned short*)malloc(sizeof(unsigned short) * (blocksize + 1));
+  ZopfliState* state = s->options->state;
+  unsigned short* length_array;
   unsigned short* path = 0;
   size_t pathsize = 0;
-  ZopfliLZ77Store currentstore;
+  ZopfliLZ77Store ownstore;
+  ZopfliLZ77Store* currentstore;
   ZopfliHash hash;
-  ZopfliHash* h = &hash;
+  ZopfliHash* h;
   SymbolStats stats, beststats, laststats;
   int i;
-  float* costs = (float*)malloc(sizeof(float) * (blocksize + 1));
+  float* costs;
   double cost;
   double bestcost = ZOPFLI_LARGE_FLOAT;
   double lastcost = 0;
@@ -466,42 +504,39 @@ void ZopfliLZ77Optimal(ZopfliBlockState *s,
   RanState ran_state;
   int lastrandomstep = -1;
 
-  if (!costs) exit(-1); /* Allocation failed. */
-  if (!length_array) exit(-1); /* Allocation failed. */
-
+  GetArrays(state, blocksize, &length_array, &costs);
   InitRanState(&ran_state);
   InitStats(&stats);
-  ZopfliInitLZ77Store(in, &currentstore);
-  ZopfliAllocHash(ZOPFLI_WINDOW_SIZE, h);
+  currentstore = ZopfliGetLZ77Store(state, in, &ownstore);
+  h = ZopfliGetHash(state, &hash);
 
   /* Do regular deflate, then loop multiple shortest path runs, each time using
   the statistics of the previous run. */
 
   /* Initial run. */
-  ZopfliLZ77Greedy(s, in, instart, inend, &currentstore, h);
-  GetStatistics(&currentstore, &stats);
+  ZopfliLZ77Greedy(s, in, instart, inend, currentstore, h);
+  GetStatistics(currentstore, &stats);
 
   /* Repeat statistics with each time the cost model from the previous stat
   run. */
   for (i = 0; i < numiterations; i++) {
-    ZopfliCleanLZ77Store(&currentstore);
-    ZopfliInitLZ77Store(in, &currentstore);
+    ZopfliResetLZ77Store(in, currentstore);
     LZ77OptimalRun(s, in, instart, inend, &path, &pathsize,
                    length_array, GetCostStat, (void*)&stats,
-                   &currentstore, h, costs);
-    cost = ZopfliCalculateBlockSize(&currentstore, 0, currentstore.size, 2);
+                   currentstore, h, costs);
+    cost = ZopfliCalculateBlockSize(currentstore, 0, currentstore->size, 2);
     if (s->options->verbose_more || (s->options->verbose && cost < bestcost)) {
       fprintf(stderr, "Iteration %d: %d bit\n", i, (int) cost);
     }
     if (cost < bestcost) {
       /* Copy to the output store. */
-      ZopfliCopyLZ77Store(&currentstore, store);
+      ZopfliCopyLZ77Store(currentstore, store);
       CopyStats(&stats, &beststats);
       bestcost = cost;
     }
     CopyStats(&stats, &laststats);
     ClearStatFreqs(&stats);
-    GetStatistics(&currentstore, &stats);
+    GetStatistics(currentstore, &stats);
     if (lastrandomstep != -1) {
       /* This makes it converge slower but better. Do it only once the
       randomness kicks in so that if the user does few iterations, it gives a
@@ -516,13 +551,13 @@ void ZopfliLZ77Optimal(ZopfliBlockState *s,
       lastrandomstep = i;
     }
     lastcost = cost;
+    if (s->options->stop && s->options->stop(s->options->stop_arg)) break;
   }
 
-  free(length_array);
+  PutArrays(state, length_array, costs);
   free(path);
-  free(costs);
-  ZopfliCleanLZ77Store(&currentstore);
-  ZopfliCleanHash(h);
+  ZopfliPutLZ77Store(state, currentstore);
+  ZopfliPutHash(state, h);
 }
 
 void ZopfliLZ77OptimalFixed(ZopfliBlockState *s,
@@ -532,18 +567,16 @@ void ZopfliLZ77OptimalFixed(ZopfliBlockState *s,
 {
   /* Dist to get to here with smallest cost. */
   size_t blocksize = inend - instart;
-  unsigned short* length_array =
-      (unsigned short*)malloc(sizeof(unsigned short) * (blocksize + 1));
+  ZopfliState* state = s->options->state;
+  unsigned short* length_array;
   unsigned short* path = 0;
   size_t pathsize = 0;
   ZopfliHash hash;
-  ZopfliHash* h = &hash;
-  float* costs = (float*)malloc(sizeof(float) * (blocksize + 1));
-
-  if (!costs) exit(-1); /* Allocation failed. */
-  if (!length_array) exit(-1); /* Allocation failed. */
+  ZopfliHash* h;
+  float* costs;
 
-  ZopfliAllocHash(ZOPFLI_WINDOW_SIZE, h);
+  GetArrays(state, blocksize, &length_array, &costs);
+  h = ZopfliGetHash(state, &hash);
 
   s->blockstart = instart;
   s->blockend = inend;
@@ -553,8 +586,7 @@ void ZopfliLZ77OptimalFixed(ZopfliBlockState *s,
   LZ77OptimalRun(s, in, instart, inend, &path, &pathsize,
                  length_array, GetCostFixed, 0, store, h, costs);
 
-  free(length_array);
+  PutArrays(state, length_array, costs);
   free(path);
-  free(costs);
-  ZopfliCleanHash(h);
+  ZopfliPutHash(state, h);
 }
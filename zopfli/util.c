@@ -32,4 +32,11 @@ void ZopfliInitOptions(ZopfliOptions* options) {
   options->blocksplitting = 1;
   options->blocksplittinglast = 0;
   options->blocksplittingmax = 15;
+  options->stop = 0;
+  options->stop_arg = 0;
+  options->state = 0;
+  options->cache_limit = 0;
+  options->parallel = 0;
+  options->parallel_blocks = 0;
+  options->thread_state = 0;
 }
@@ -61,6 +61,42 @@ typedef struct ZopfliOptions {
   extreme results that hurt compression on some files). Default value: 15.
   */
   int blocksplittingmax;
+
+  /*
+  If not NULL, called after each iteration; nonzero ends the iterations early.
+  */
+  int (*stop)(void* stop_arg);
+  void* stop_arg;
+
+  /*
+  If not NULL, buffers kept from one compression to the next (see lz77.h).
+  */
+  struct ZopfliState* state;
+
+  /*
+  Most bytes the longest match cache of a block may take (0 for no limit).
+  Beyond it only the start of the block is cached: slower, same output.
+  */
+  size_t cache_limit;
+
+  /*
+  If not NULL, calls fn(arg, i) for each i from 0 to n - 1, possibly at the
+  same time on other threads, and returns when all are done. Master blocks of
+  large inputs are then compressed in parallel; the output is the same.
+  */
+  void (*parallel)(void (*fn)(void* arg, int i), void* arg, int n);
+
+  /*
+  With parallel: how many master blocks to compress at a time, at least 2,
+  typically the number of threads. Each takes memory until it is written out.
+  */
+  int parallel_blocks;
+
+  /*
+  With parallel: if not NULL, gives the state to use on the thread it is
+  called on. Otherwise master blocks on other threads have none.
+  */
+  struct ZopfliState* (*thread_state)(void);
 } ZopfliOptions;
 
 /* Initializes options with default values. */